@@ -0,0 +1,124 @@
+#ifndef BAKED_TEXTURE_H
+#define BAKED_TEXTURE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <mipmap.h>
+
+// On-disk layout of a baked texture (see tools/texbake.cpp): an image decoded
+// ahead of time with its full mip chain, ready to hand to glTexImage2D level
+// by level straight from a mapping. All little-endian as written by the host:
+//
+//   BakedTextureHeader               the level table included
+//   level 0, level 1, ...            at levels[i].offset, levels[i].bytes each
+//
+// Pixels are 8 bits per channel with tightly packed rows (upload with
+// GL_UNPACK_ALIGNMENT 1), top row first unless flipped on bake. Levels of a
+// page or more start on a page boundary, smaller ones on 64 bytes. The
+// source file's size and mtime say whether the bake is still current.
+static const int BAKED_TEXTURE_MAX_LEVELS = 32;
+
+struct BakedTextureLevel
+{
+    uint64_t offset;
+    uint64_t bytes;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct BakedTextureHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t nrChannels;
+    uint32_t desiredChannels; // as passed to stb_image, 0 = the file's own
+    uint32_t flags;           // BAKED_TEXTURE_*
+    uint32_t levelCount;
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceMtime; // nanoseconds since the epoch
+    BakedTextureLevel levels[BAKED_TEXTURE_MAX_LEVELS];
+};
+
+static const char BAKED_TEXTURE_MAGIC[8] = { 'T', 'E', 'X', 'B', 'A', 'K', 'E', 'D' };
+static const uint32_t BAKED_TEXTURE_VERSION = 1;
+static const uint32_t BAKED_TEXTURE_FLIPPED = 1;
+static const uint32_t BAKED_TEXTURE_SRGB_MIPS = 2;   // mips filtered in linear light
+static const uint32_t BAKED_TEXTURE_KAISER_MIPS = 4; // with MIP_KAISER rather than MIP_BOX
+
+// the BAKED_TEXTURE_*_MIPS flags of a chain built with settings
+inline uint32_t bakedTextureMipFlags(const MipSettings& settings)
+{
+    return (settings.srgb ? BAKED_TEXTURE_SRGB_MIPS : 0) |
+           (settings.filter == MIP_KAISER ? BAKED_TEXTURE_KAISER_MIPS : 0);
+}
+
+// where the bake of a source image lives
+inline std::string bakedTexturePath(const std::string& sourcePath)
+{
+    return sourcePath + ".baked";
+}
+
+// fill in a header for a levelCount-level chain of a width x height image
+// and return the total file size
+inline uint64_t bakedTextureLayout(BakedTextureHeader& header, int width, int height, int nrChannels,
+                                   int levelCount)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BAKED_TEXTURE_MAGIC, sizeof(header.magic));
+    header.version = BAKED_TEXTURE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.nrChannels = nrChannels;
+    header.levelCount = levelCount;
+    uint64_t offset = sizeof(header);
+    for (int i = 0; i < levelCount; i++)
+    {
+        BakedTextureLevel& level = header.levels[i];
+        level.width = width >> i ? width >> i : 1;
+        level.height = height >> i ? height >> i : 1;
+        level.bytes = (uint64_t)level.width * level.height * nrChannels;
+        uint64_t alignment = level.bytes >= 4096 ? 4096 : 64;
+        level.offset = (offset + alignment - 1) & ~(alignment - 1);
+        offset = level.offset + level.bytes;
+    }
+    return offset;
+}
+
+// true if header describes a file of fileSize bytes this code can read
+inline bool bakedTextureValid(const BakedTextureHeader& header, uint64_t fileSize)
+{
+    if (memcmp(header.magic, BAKED_TEXTURE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != BAKED_TEXTURE_VERSION || header.levelCount < 1 ||
+        header.levelCount > (uint32_t)BAKED_TEXTURE_MAX_LEVELS || header.nrChannels < 1 || header.nrChannels > 4)
+        return false;
+    for (uint32_t i = 0; i < header.levelCount; i++)
+    {
+        const BakedTextureLevel& level = header.levels[i];
+        if (level.width != (header.width >> i ? header.width >> i : 1) ||
+            level.height != (header.height >> i ? header.height >> i : 1) ||
+            level.bytes != (uint64_t)level.width * level.height * header.nrChannels ||
+            level.offset < sizeof(header) || level.offset > fileSize || level.bytes > fileSize - level.offset)
+            return false;
+    }
+    return true;
+}
+
+// true if the bake was made from the source as it is now (size and mtime)
+// with the same flip and desired channels the caller would decode it with
+inline bool bakedTextureCurrent(const BakedTextureHeader& header, uint64_t sourceSize, int64_t sourceMtime, bool flip,
+                                int desiredChannels)
+{
+    return header.sourceSize == sourceSize && header.sourceMtime == sourceMtime &&
+           ((header.flags & BAKED_TEXTURE_FLIPPED) != 0) == flip && header.desiredChannels == (uint32_t)desiredChannels;
+}
+
+inline unsigned char* bakedTextureLevel(unsigned char* base, const BakedTextureHeader& header, uint32_t level)
+{
+    return base + header.levels[level].offset;
+}
+#endif
@@ -0,0 +1,682 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <threadPool.h>
+
+// CPU block compression of 8-bit images as stb_image returns them, so
+// textures take 4 or 8 bits per texel of VRAM instead of 24 or 32. Each 4x4
+// block is fitted on its own: endpoints along the principal axis of its
+// colours, every texel given the nearest palette entry, then the endpoints
+// refitted by least squares to those indices and kept if the error drops.
+// Partial blocks at the right and bottom edges repeat the last texel.
+//
+//   BC1  RGB, 8 bytes a block, always in four-colour mode
+//   BC3  BC1 colour plus an 8-byte interpolated alpha block (BC4 style),
+//        whichever of its two modes fits the block better
+//   BC7  RGBA, 16 bytes a block, mode 6 only: one subset, 7-bit endpoints
+//        with a p-bit each and 16 interpolation steps. Much closer than BC1
+//        on smooth blocks; blocks with several distinct colours would need
+//        the partitioned modes, which this encoder doesn't try
+//
+// The nearest-entry search, run two or three times a block, has an SSE2
+// kernel that does four texels at a time; palettes and texels are whole
+// numbers, so it picks the same indices as the scalar loop.
+// blockCompress() spreads rows of blocks over a ThreadPool. #define
+// BLOCK_COMPRESS_NO_SIMD for scalar only.
+#if !defined(BLOCK_COMPRESS_NO_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BLOCK_COMPRESS_SSE2
+#include <emmintrin.h>
+#endif
+
+enum BlockFormat
+{
+    BLOCK_BC1, // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    BLOCK_BC3, // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    BLOCK_BC7  // GL_COMPRESSED_RGBA_BPTC_UNORM
+};
+
+inline int blockBytes(BlockFormat format)
+{
+    return format == BLOCK_BC1 ? 8 : 16;
+}
+
+// bytes of a width x height image in format, what glCompressedTexImage2D
+// wants as imageSize
+inline size_t blockCompressedSize(BlockFormat format, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+// one block's texels as float RGBA, channel by channel
+struct BcBlock
+{
+    float c[4][16];
+};
+
+inline void bcLoadBlock(const unsigned char* pixels, int width, int height, int nrChannels, int bx, int by,
+                        BcBlock& block)
+{
+    for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 4; x++)
+        {
+            const unsigned char* p = pixels + ((size_t)std::min(by * 4 + y, height - 1) * width +
+                                               std::min(bx * 4 + x, width - 1)) * nrChannels;
+            int i = y * 4 + x;
+            bool gray = nrChannels < 3;
+            block.c[0][i] = p[0];
+            block.c[1][i] = gray ? p[0] : p[1];
+            block.c[2][i] = gray ? p[0] : p[2];
+            block.c[3][i] = nrChannels == 2 ? p[1] : nrChannels == 4 ? p[3] : 255.0f;
+        }
+}
+
+#ifdef BLOCK_COMPRESS_SSE2
+// squared distance of four texels, channel by channel, to a palette entry
+template <int channels>
+inline __m128 bcDistance(__m128 r, __m128 g, __m128 b, __m128 a, const float* entry)
+{
+    __m128 d = _mm_sub_ps(r, _mm_set1_ps(entry[0]));
+    __m128 distance = _mm_mul_ps(d, d);
+    if (channels > 1)
+    {
+        d = _mm_sub_ps(g, _mm_set1_ps(entry[1]));
+        distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+        d = _mm_sub_ps(b, _mm_set1_ps(entry[2]));
+        distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+    }
+    if (channels > 3)
+    {
+        d = _mm_sub_ps(a, _mm_set1_ps(entry[3]));
+        distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+    }
+    return distance;
+}
+
+// keep entry index where distance beats best; ties stay with the earlier
+inline void bcCloser(__m128 distance, __m128i index, __m128& best, __m128i& bestIndex)
+{
+    __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+    best = _mm_min_ps(distance, best);
+    bestIndex = _mm_or_si128(_mm_and_si128(closer, index), _mm_andnot_si128(closer, bestIndex));
+}
+#endif
+
+// the nearest of the paletteSize entries for each texel, by squared
+// distance over the first channels (1, 3 or 4); returns the summed error
+template <int channels, int paletteSize>
+inline float bcNearest(const BcBlock& block, const float (*palette)[4], unsigned char* indices)
+{
+#ifdef BLOCK_COMPRESS_SSE2
+    // eight texels at a time, so two compare chains overlap; the errors are
+    // whole numbers, so summing them in any order gives the scalar total
+    __m128 sum = _mm_setzero_ps();
+    for (int i = 0; i < 16; i += 8)
+    {
+        __m128 r0 = _mm_loadu_ps(&block.c[0][i]), r1 = _mm_loadu_ps(&block.c[0][i + 4]);
+        __m128 g0 = r0, g1 = r1, b0 = r0, b1 = r1, a0 = r0, a1 = r1;
+        if (channels > 1)
+        {
+            g0 = _mm_loadu_ps(&block.c[1][i]);
+            g1 = _mm_loadu_ps(&block.c[1][i + 4]);
+            b0 = _mm_loadu_ps(&block.c[2][i]);
+            b1 = _mm_loadu_ps(&block.c[2][i + 4]);
+        }
+        if (channels > 3)
+        {
+            a0 = _mm_loadu_ps(&block.c[3][i]);
+            a1 = _mm_loadu_ps(&block.c[3][i + 4]);
+        }
+        __m128 best0 = _mm_set1_ps(FLT_MAX), best1 = best0;
+        __m128i index0 = _mm_setzero_si128(), index1 = index0;
+        for (int p = 0; p < paletteSize; p++)
+        {
+            __m128i index = _mm_set1_epi32(p);
+            bcCloser(bcDistance<channels>(r0, g0, b0, a0, palette[p]), index, best0, index0);
+            bcCloser(bcDistance<channels>(r1, g1, b1, a1, palette[p]), index, best1, index1);
+        }
+        sum = _mm_add_ps(sum, _mm_add_ps(best0, best1));
+        __m128i packed = _mm_packs_epi32(index0, index1);
+        _mm_storel_epi64((__m128i*)(indices + i), _mm_packus_epi16(packed, packed));
+    }
+    float errors[4];
+    _mm_storeu_ps(errors, sum);
+    return (errors[0] + errors[1]) + (errors[2] + errors[3]);
+#else
+    float total = 0.0f;
+    for (int i = 0; i < 16; i++)
+    {
+        float best = FLT_MAX;
+        for (int p = 0; p < paletteSize; p++)
+        {
+            float distance = 0.0f;
+            for (int c = 0; c < channels; c++)
+            {
+                float d = block.c[c][i] - palette[p][c];
+                distance += d * d;
+            }
+            if (distance < best)
+            {
+                best = distance;
+                indices[i] = (unsigned char)p;
+            }
+        }
+        total += best;
+    }
+    return total;
+#endif
+}
+
+// endpoints through the texels along their principal axis, over RGB or
+// RGBA, pulled in by inset of their spread
+template <int channels>
+inline void bcPrincipalEndpoints(const BcBlock& block, float inset, float lo[4], float hi[4])
+{
+    // a missing alpha stays at zero throughout
+    float mean[4] = { 0, 0, 0, 0 }, axis[4] = { 0, 0, 0, 0 };
+    for (int c = 0; c < channels; c++)
+    {
+        float least = 255.0f, most = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            mean[c] += block.c[c][i];
+            least = std::min(least, block.c[c][i]);
+            most = std::max(most, block.c[c][i]);
+        }
+        mean[c] /= 16;
+        axis[c] = most - least;
+    }
+    // covariance: rr rg rb ra gg gb ga bb ba aa
+    float cov[10] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float r = block.c[0][i] - mean[0], g = block.c[1][i] - mean[1], b = block.c[2][i] - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[4] += g * g;
+        cov[5] += g * b;
+        cov[7] += b * b;
+        if (channels > 3)
+        {
+            float a = block.c[3][i] - mean[3];
+            cov[3] += r * a;
+            cov[6] += g * a;
+            cov[8] += b * a;
+            cov[9] += a * a;
+        }
+    }
+    // power iteration from the channel ranges, which a few steps turn onto
+    // the principal axis; a flat block leaves the axis at zero
+    for (int iteration = 0; iteration < 4; iteration++)
+    {
+        float r = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2] + cov[3] * axis[3];
+        float g = cov[1] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] + cov[6] * axis[3];
+        float b = cov[2] * axis[0] + cov[5] * axis[1] + cov[7] * axis[2] + cov[8] * axis[3];
+        float a = cov[3] * axis[0] + cov[6] * axis[1] + cov[8] * axis[2] + cov[9] * axis[3];
+        float length = std::max(std::max(std::fabs(r), std::fabs(g)), std::max(std::fabs(b), std::fabs(a)));
+        float scale = length > 0.0f ? 1.0f / length : 0.0f;
+        axis[0] = r * scale;
+        axis[1] = g * scale;
+        axis[2] = b * scale;
+        axis[3] = a * scale;
+    }
+    float length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3];
+    float tMin = 0.0f, tMax = 0.0f;
+    if (length > 0.0f)
+    {
+        float scale = 1.0f / std::sqrt(length);
+        for (int c = 0; c < 4; c++)
+            axis[c] *= scale;
+        tMin = FLT_MAX, tMax = -FLT_MAX;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = (block.c[0][i] - mean[0]) * axis[0] + (block.c[1][i] - mean[1]) * axis[1] +
+                      (block.c[2][i] - mean[2]) * axis[2];
+            if (channels > 3)
+                t += (block.c[3][i] - mean[3]) * axis[3];
+            tMin = std::min(tMin, t);
+            tMax = std::max(tMax, t);
+        }
+        float pull = (tMax - tMin) * inset;
+        tMin += pull;
+        tMax -= pull;
+    }
+    for (int c = 0; c < channels; c++)
+    {
+        lo[c] = std::min(std::max(mean[c] + tMin * axis[c], 0.0f), 255.0f);
+        hi[c] = std::min(std::max(mean[c] + tMax * axis[c], 0.0f), 255.0f);
+    }
+}
+
+// a and b minimising the squared error of (1 - w) a + w b against each
+// texel, w its index's weight; false when every texel has the same weight
+template <int channels>
+inline bool bcLeastSquares(const BcBlock& block, const unsigned char* indices, const float* weights, float a[4],
+                           float b[4])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = { 0, 0, 0, 0 }, bx[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+    {
+        float w = weights[indices[i]], v = 1.0f - w;
+        aa += v * v;
+        ab += v * w;
+        bb += w * w;
+        for (int c = 0; c < channels; c++)
+        {
+            ax[c] += v * block.c[c][i];
+            bx[c] += w * block.c[c][i];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f)
+        return false;
+    for (int c = 0; c < channels; c++)
+    {
+        a[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / det, 0.0f), 255.0f);
+        b[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / det, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+// little-endian bit stream into a zeroed block
+struct BcBits
+{
+    unsigned char* out;
+    int pos = 0;
+
+    explicit BcBits(unsigned char* out)
+        : out(out)
+    {
+    }
+    // up to a byte at a time
+    void put(uint32_t value, int bits)
+    {
+        while (bits > 0)
+        {
+            int shift = pos & 7, take = std::min(bits, 8 - shift);
+            out[pos >> 3] |= (unsigned char)((value & ((1u << take) - 1)) << shift);
+            value >>= take;
+            bits -= take;
+            pos += take;
+        }
+    }
+    uint32_t get(int bits)
+    {
+        uint32_t value = 0;
+        for (int done = 0; done < bits;)
+        {
+            int shift = pos & 7, take = std::min(bits - done, 8 - shift);
+            value |= (uint32_t)((out[pos >> 3] >> shift) & ((1u << take) - 1)) << done;
+            done += take;
+            pos += take;
+        }
+        return value;
+    }
+};
+
+// --- BC1 colour ------------------------------------------------------------
+
+inline uint16_t bcPack565(const float c[4])
+{
+    int r = std::min(std::max((int)(c[0] * 31.0f / 255.0f + 0.5f), 0), 31);
+    int g = std::min(std::max((int)(c[1] * 63.0f / 255.0f + 0.5f), 0), 63);
+    int b = std::min(std::max((int)(c[2] * 31.0f / 255.0f + 0.5f), 0), 31);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void bcUnpack565(uint16_t v, int rgb[3])
+{
+    int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// the palette a decoder builds from color0 and color1
+inline void bcColorPalette(uint16_t color0, uint16_t color1, float palette[4][4])
+{
+    int c0[3], c1[3];
+    bcUnpack565(color0, c0);
+    bcUnpack565(color1, c1);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[0][c] = (float)c0[c];
+        palette[1][c] = (float)c1[c];
+        if (color0 > color1)
+        {
+            palette[2][c] = (float)((2 * c0[c] + c1[c]) / 3);
+            palette[3][c] = (float)((c0[c] + 2 * c1[c]) / 3);
+        }
+        else
+        {
+            palette[2][c] = (float)((c0[c] + c1[c]) / 2);
+            palette[3][c] = 0.0f;
+        }
+    }
+}
+
+// indices for a pair of endpoints, ordered for four-colour mode (a block
+// whose endpoints quantize to the same colour only ever uses index 0)
+inline float bcColorTry(const BcBlock& block, uint16_t& color0, uint16_t& color1, unsigned char indices[16])
+{
+    if (color0 < color1)
+        std::swap(color0, color1);
+    float palette[4][4];
+    bcColorPalette(color0, color1, palette);
+    if (color0 == color1)
+        palette[2][0] = palette[2][1] = palette[2][2] = palette[3][0] = palette[3][1] = palette[3][2] = -1e6f;
+    return bcNearest<3, 4>(block, palette, indices);
+}
+
+inline void bcEncodeColor(const BcBlock& block, unsigned char out[8])
+{
+    static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+    float lo[4], hi[4];
+    bcPrincipalEndpoints<3>(block, 1.0f / 16.0f, lo, hi);
+    uint16_t color0 = bcPack565(hi), color1 = bcPack565(lo);
+    unsigned char indices[16];
+    float error = bcColorTry(block, color0, color1, indices);
+    for (int iteration = 0; iteration < 2 && error > 0.0f; iteration++)
+    {
+        float a[4], b[4];
+        unsigned char tried[16];
+        if (!bcLeastSquares<3>(block, indices, weights, a, b))
+            break;
+        uint16_t try0 = bcPack565(a), try1 = bcPack565(b);
+        float tryError = bcColorTry(block, try0, try1, tried);
+        if (tryError >= error)
+            break;
+        error = tryError;
+        color0 = try0;
+        color1 = try1;
+        memcpy(indices, tried, sizeof(indices));
+    }
+    memset(out, 0, 8);
+    BcBits bits(out);
+    bits.put(color0, 16);
+    bits.put(color1, 16);
+    for (int i = 0; i < 16; i++)
+        bits.put(indices[i], 2);
+}
+
+// --- BC3 alpha -------------------------------------------------------------
+
+inline void bcAlphaPalette(int alpha0, int alpha1, float palette[8][4])
+{
+    palette[0][0] = (float)alpha0;
+    palette[1][0] = (float)alpha1;
+    if (alpha0 > alpha1)
+    {
+        for (int i = 2; i < 8; i++)
+            palette[i][0] = (float)(((8 - i) * alpha0 + (i - 1) * alpha1 + 3) / 7);
+    }
+    else
+    {
+        for (int i = 2; i < 6; i++)
+            palette[i][0] = (float)(((6 - i) * alpha0 + (i - 1) * alpha1 + 2) / 5);
+        palette[6][0] = 0.0f;
+        palette[7][0] = 255.0f;
+    }
+}
+
+// alpha goes through bcNearest as channel 0
+inline float bcAlphaTry(const BcBlock& alpha, int alpha0, int alpha1, unsigned char indices[16])
+{
+    float palette[8][4];
+    bcAlphaPalette(alpha0, alpha1, palette);
+    return bcNearest<1, 8>(alpha, palette, indices);
+}
+
+// eight steps between the extremes, or six between the extremes other than
+// 0 and 255 with those two exact; whichever fits better
+inline void bcEncodeAlpha(const BcBlock& block, unsigned char out[8])
+{
+    BcBlock alpha;
+    memcpy(alpha.c[0], block.c[3], sizeof(alpha.c[0]));
+    int lo = 255, hi = 0, innerLo = 255, innerHi = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int a = (int)alpha.c[0][i];
+        lo = std::min(lo, a);
+        hi = std::max(hi, a);
+        if (a != 0 && a != 255)
+        {
+            innerLo = std::min(innerLo, a);
+            innerHi = std::max(innerHi, a);
+        }
+    }
+    if (innerLo > innerHi)
+        innerLo = innerHi = lo;
+    unsigned char indices[16], tried[16];
+    int alpha0 = hi, alpha1 = lo;
+    float error = bcAlphaTry(alpha, alpha0, alpha1, indices);
+    if (error > 0.0f && bcAlphaTry(alpha, innerLo, innerHi, tried) < error)
+    {
+        alpha0 = innerLo;
+        alpha1 = innerHi;
+        memcpy(indices, tried, sizeof(indices));
+    }
+    memset(out, 0, 8);
+    BcBits bits(out);
+    bits.put(alpha0, 8);
+    bits.put(alpha1, 8);
+    for (int i = 0; i < 16; i++)
+        bits.put(indices[i], 3);
+}
+
+// --- BC7 mode 6 ------------------------------------------------------------
+
+static const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// 7 bits per channel and a shared p-bit as the low bit: the p-bit that
+// lands the endpoint closest
+inline void bcQuantizeBc7(const float e[4], int q[4], int& pbit)
+{
+    float bestError = FLT_MAX;
+    for (int p = 0; p < 2; p++)
+    {
+        int tried[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++)
+        {
+            tried[c] = std::min(std::max((int)((e[c] - p) / 2.0f + 0.5f), 0), 127);
+            float d = (float)(tried[c] * 2 + p) - e[c];
+            error += d * d;
+        }
+        if (error < bestError)
+        {
+            bestError = error;
+            pbit = p;
+            memcpy(q, tried, sizeof(tried));
+        }
+    }
+}
+
+inline void bcBc7Palette(const int q0[4], int p0, const int q1[4], int p1, float palette[16][4])
+{
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 4; c++)
+        {
+            int e0 = q0[c] * 2 + p0, e1 = q1[c] * 2 + p1;
+            palette[i][c] = (float)(((64 - BC7_WEIGHTS4[i]) * e0 + BC7_WEIGHTS4[i] * e1 + 32) >> 6);
+        }
+}
+
+inline float bcBc7Try(const BcBlock& block, const float a[4], const float b[4], int q0[4], int& p0, int q1[4],
+                      int& p1, unsigned char indices[16])
+{
+    float palette[16][4];
+    bcQuantizeBc7(a, q0, p0);
+    bcQuantizeBc7(b, q1, p1);
+    bcBc7Palette(q0, p0, q1, p1, palette);
+    return bcNearest<4, 16>(block, palette, indices);
+}
+
+inline void bcEncodeBc7(const BcBlock& block, unsigned char out[16])
+{
+    static const float weights[16] = { 0 / 64.0f,  4 / 64.0f,  9 / 64.0f,  13 / 64.0f, 17 / 64.0f, 21 / 64.0f,
+                                       26 / 64.0f, 30 / 64.0f, 34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f,
+                                       51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f };
+    float lo[4], hi[4];
+    bcPrincipalEndpoints<4>(block, 1.0f / 64.0f, lo, hi);
+    int q0[4], q1[4], p0, p1;
+    unsigned char indices[16];
+    float error = bcBc7Try(block, lo, hi, q0, p0, q1, p1, indices);
+    for (int iteration = 0; iteration < 2 && error > 0.0f; iteration++)
+    {
+        float a[4], b[4];
+        int t0[4], t1[4], tp0, tp1;
+        unsigned char tried[16];
+        if (!bcLeastSquares<4>(block, indices, weights, a, b))
+            break;
+        float tryError = bcBc7Try(block, a, b, t0, tp0, t1, tp1, tried);
+        if (tryError >= error)
+            break;
+        error = tryError;
+        memcpy(q0, t0, sizeof(q0));
+        memcpy(q1, t1, sizeof(q1));
+        p0 = tp0;
+        p1 = tp1;
+        memcpy(indices, tried, sizeof(indices));
+    }
+    // the first index is stored with its top bit implied 0
+    if (indices[0] >= 8)
+    {
+        for (int c = 0; c < 4; c++)
+            std::swap(q0[c], q1[c]);
+        std::swap(p0, p1);
+        for (int i = 0; i < 16; i++)
+            indices[i] = (unsigned char)(15 - indices[i]);
+    }
+    memset(out, 0, 16);
+    BcBits bits(out);
+    bits.put(1 << 6, 7);
+    for (int c = 0; c < 4; c++)
+    {
+        bits.put(q0[c], 7);
+        bits.put(q1[c], 7);
+    }
+    bits.put(p0, 1);
+    bits.put(p1, 1);
+    bits.put(indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        bits.put(indices[i], 4);
+}
+
+// compress a width x height image of nrChannels (1 to 4) 8-bit values into
+// blockCompressedSize(format, width, height) bytes at out, block rows over
+// pool when given
+// ----------------------------------------------------------------------------
+inline void blockCompress(const unsigned char* pixels, int width, int height, int nrChannels, BlockFormat format,
+                          unsigned char* out, ThreadPool* pool = NULL)
+{
+    const int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4, bytes = blockBytes(format);
+    auto blockRow = [&](int by) {
+        BcBlock block;
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            bcLoadBlock(pixels, width, height, nrChannels, bx, by, block);
+            unsigned char* dst = out + ((size_t)by * blocksWide + bx) * bytes;
+            if (format == BLOCK_BC1)
+            {
+                bcEncodeColor(block, dst);
+            }
+            else if (format == BLOCK_BC3)
+            {
+                bcEncodeAlpha(block, dst);
+                bcEncodeColor(block, dst + 8);
+            }
+            else
+            {
+                bcEncodeBc7(block, dst);
+            }
+        }
+    };
+    if (pool && blocksHigh > 1 && (size_t)blocksWide * blocksHigh >= 256)
+        pool->parallelFor(blocksHigh, blockRow);
+    else
+        for (int by = 0; by < blocksHigh; by++)
+            blockRow(by);
+}
+
+// and back to RGBA, 4 bytes a texel, for checking the encoder; BC7 blocks
+// in other modes than 6 come out magenta
+// ----------------------------------------------------------------------------
+inline void blockDecompress(const unsigned char* blocks, int width, int height, BlockFormat format,
+                            unsigned char* rgba)
+{
+    const int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4, bytes = blockBytes(format);
+    for (int by = 0; by < blocksHigh; by++)
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            unsigned char block[16];
+            memcpy(block, blocks + ((size_t)by * blocksWide + bx) * bytes, bytes);
+            float palette[16][4];
+            int index[16], alphaIndex[16];
+            float alphaPalette[8][4];
+            bool hasAlpha = format == BLOCK_BC3;
+            if (format == BLOCK_BC7)
+            {
+                BcBits bits(block);
+                if (bits.get(7) != (1 << 6))
+                {
+                    for (int i = 0; i < 16; i++)
+                    {
+                        palette[i][0] = palette[i][2] = palette[i][3] = 255.0f;
+                        palette[i][1] = 0.0f;
+                        index[i] = i;
+                    }
+                }
+                else
+                {
+                    int q0[4], q1[4];
+                    for (int c = 0; c < 4; c++)
+                    {
+                        q0[c] = (int)bits.get(7);
+                        q1[c] = (int)bits.get(7);
+                    }
+                    int p0 = (int)bits.get(1), p1 = (int)bits.get(1);
+                    bcBc7Palette(q0, p0, q1, p1, palette);
+                    for (int i = 0; i < 16; i++)
+                        index[i] = (int)bits.get(i == 0 ? 3 : 4);
+                }
+            }
+            else
+            {
+                unsigned char* color = block + (hasAlpha ? 8 : 0);
+                BcBits bits(color);
+                uint16_t color0 = (uint16_t)bits.get(16), color1 = (uint16_t)bits.get(16);
+                bcColorPalette(color0, color1, palette);
+                for (int i = 0; i < 4; i++)
+                    palette[i][3] = color0 <= color1 && i == 3 && !hasAlpha ? 0.0f : 255.0f;
+                for (int i = 0; i < 16; i++)
+                    index[i] = (int)bits.get(2);
+                if (hasAlpha)
+                {
+                    BcBits alphaBits(block);
+                    int alpha0 = (int)alphaBits.get(8), alpha1 = (int)alphaBits.get(8);
+                    bcAlphaPalette(alpha0, alpha1, alphaPalette);
+                    for (int i = 0; i < 16; i++)
+                        alphaIndex[i] = (int)alphaBits.get(3);
+                }
+            }
+            for (int y = 0; y < 4 && by * 4 + y < height; y++)
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                {
+                    int i = y * 4 + x;
+                    unsigned char* p = rgba + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4;
+                    for (int c = 0; c < 4; c++)
+                        p[c] = (unsigned char)palette[index[i]][c];
+                    if (hasAlpha)
+                        p[3] = (unsigned char)alphaPalette[alphaIndex[i]][0];
+                }
+        }
+}
+#endif
@@ -0,0 +1,149 @@
+#ifndef CAPTURE_CONTROLLER_H
+#define CAPTURE_CONTROLLER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <utility>
+
+#include <fastHash.h>
+#include <pboReadback.h>
+#include <captureQueue.h>
+
+// Turns the capture key into one screenshot per press and keeps identical
+// frames off the disk. update() is fed the raw key state every frame and
+// starts a readback only on a debounced press edge; poll() hashes each
+// finished readback and only queues it for encoding when it differs from
+// the last frame that was written. Files are named
+// <directory><year>_<month>_<day>_<sequence>.png with the sequence number
+// continuing after any capture already on disk.
+class CaptureController
+{
+public:
+    CaptureController(const std::string& directory, PboReadback& ring, CaptureQueue& queue,
+                      double debounceSeconds = 0.15)
+        : directory(directory), ring(ring), queue(queue), debounceSeconds(debounceSeconds)
+    {
+    }
+
+    // feed the current key state; returns true if a capture was started
+    // ------------------------------------------------------------------------
+    bool update(bool keyDown, double now)
+    {
+        bool pressed = keyDown && !wasDown;
+        wasDown = keyDown;
+        if (!pressed || now - lastTrigger < debounceSeconds)
+            return false;
+
+        lastTrigger = now;
+        if (!ring.request(GL_FRONT))
+        {
+            std::cout << "Capture skipped, readback ring full" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // PNG tier and filter for the captures queued from now on; the store tier
+    // is fast enough to keep up with capturing every frame, and RLE only on
+    // flat content (on photographic frames it runs about as fast as FAST)
+    // ------------------------------------------------------------------------
+    void setPngMode(CaptureQueue::PngTier tier, CaptureQueue::PngFilter filter = CaptureQueue::FILTER_ADAPTIVE)
+    {
+        pngTier = tier;
+        pngFilter = filter;
+    }
+
+    // queue every finished readback that isn't a repeat of the last capture
+    // ------------------------------------------------------------------------
+    void poll()
+    {
+        CaptureQueue::Job job;
+        job.frame.pixels = queue.takeBuffer();
+        while (ring.retrieve(job.frame))
+        {
+            PboReadback::Frame& frame = job.frame;
+            uint64_t hash = fastHashRows(frame.pixels.data(), (size_t)frame.width * frame.nrChannels,
+                                         frame.height, frame.stride);
+            if (haveLast && hash == lastHash)
+            {
+                duplicates++;
+                continue;
+            }
+            lastHash = hash;
+            haveLast = true;
+
+            job.path = nextPath();
+            job.format = CaptureQueue::PNG;
+            job.pngTier = pngTier;
+            job.pngFilter = pngFilter;
+            queue.push(std::move(job));
+
+            job = CaptureQueue::Job();
+            job.frame.pixels = queue.takeBuffer();
+        }
+        // most frames retrieve nothing; keep the buffer for the next capture
+        queue.returnBuffer(std::move(job.frame.pixels));
+    }
+
+    // next unused file name for today's date
+    // ------------------------------------------------------------------------
+    std::string nextPath()
+    {
+        time_t now = time(0);
+        tm* localTime = localtime(&now);
+        std::string date = std::to_string(localTime->tm_year + 1900) + "_" +
+                           std::to_string(localTime->tm_mon + 1) + "_" +
+                           std::to_string(localTime->tm_mday);
+        if (date != sequenceDate)
+        {
+            // new day (or first capture): pick up after what is already there
+            sequenceDate = date;
+            sequence = 0;
+            probeExisting = true;
+        }
+
+        for (;;)
+        {
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), "_%04d.png", sequence++);
+            std::string path = directory + date + suffix;
+            if (!probeExisting)
+                return path;
+
+            FILE* existing = fopen(path.c_str(), "rb");
+            if (!existing)
+            {
+                probeExisting = false;
+                return path;
+            }
+            fclose(existing);
+        }
+    }
+
+    unsigned long long duplicatesSkipped() const
+    {
+        return duplicates;
+    }
+
+private:
+    std::string directory;
+    PboReadback& ring;
+    CaptureQueue& queue;
+    double debounceSeconds;
+    CaptureQueue::PngTier pngTier = CaptureQueue::PNG_DEFAULT;
+    CaptureQueue::PngFilter pngFilter = CaptureQueue::FILTER_ADAPTIVE;
+
+    bool wasDown = false;
+    double lastTrigger = -1e9;
+
+    bool haveLast = false;
+    uint64_t lastHash = 0;
+    unsigned long long duplicates = 0;
+
+    std::string sequenceDate;
+    int sequence = 0;
+    bool probeExisting = true;
+};
+#endif
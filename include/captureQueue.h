@@ -0,0 +1,337 @@
+#ifndef CAPTURE_QUEUE_H
+#define CAPTURE_QUEUE_H
+
+#include "stb_image_write.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pboReadback.h>
+
+// Encodes captured frames on a small pool of worker threads so the
+// stb_image_write encoders never run on the render thread. A job owns its
+// pixel buffer from push() until a worker has written the file, after which
+// the buffer goes back to a spare list that takeBuffer() hands out again.
+class CaptureQueue
+{
+public:
+    enum Format { PNG, JPG, BMP, TGA };
+
+    // PNG speed tiers, from smallest file to fastest encode
+    enum PngTier
+    {
+        PNG_DEFAULT, // stbi_write_png_compression_level
+        PNG_FAST,    // level 1: greedy matching, short hash chains
+        PNG_RLE,     // runs of the previous byte only, no match search
+        PNG_STORE,   // stored deflate blocks, no compression at all
+        PNG_TIER_COUNT
+    };
+
+    // PNG row filter; a fixed filter skips the per-row filter search
+    enum PngFilter
+    {
+        FILTER_ADAPTIVE = -1,
+        FILTER_NONE = 0,
+        FILTER_SUB = 1,
+        FILTER_UP = 2
+    };
+
+    // what push() does when capacity jobs are already waiting
+    enum Overflow
+    {
+        DROP_OLDEST, // discard the oldest queued frame, keep the new one
+        BLOCK        // make the producer wait for a worker (backpressure)
+    };
+
+    struct Job
+    {
+        std::string path;
+        Format format = PNG;
+        PngTier pngTier = PNG_DEFAULT;
+        PngFilter pngFilter = FILTER_ADAPTIVE;
+        PboReadback::Frame frame;
+    };
+
+    // counters are updated by the workers and can be read from any thread
+    struct Stats
+    {
+        std::atomic<unsigned long long> queued{0};
+        std::atomic<unsigned long long> encoded{0};
+        std::atomic<unsigned long long> dropped{0};
+        std::atomic<unsigned long long> failed{0};
+        std::atomic<unsigned long long> bytesWritten{0};
+        // raw frame bytes and encode+write time per PNG tier
+        std::atomic<unsigned long long> tierPixelBytes[PNG_TIER_COUNT]{};
+        std::atomic<unsigned long long> tierNanoseconds[PNG_TIER_COUNT]{};
+    };
+
+    CaptureQueue(int nrWorkers = 2, size_t capacity = 4, Overflow overflow = DROP_OLDEST)
+        : nrWorkers(nrWorkers < 1 ? 1 : nrWorkers), capacity(capacity < 1 ? 1 : capacity), overflow(overflow)
+    {
+    }
+    ~CaptureQueue()
+    {
+        stop();
+    }
+    CaptureQueue(const CaptureQueue&) = delete;
+    CaptureQueue& operator=(const CaptureQueue&) = delete;
+
+    // hand a frame to the encoders; the job's buffer is moved into the queue.
+    // Returns false if an older frame had to be dropped to make room.
+    // ------------------------------------------------------------------------
+    bool push(Job&& job)
+    {
+        start();
+        bool droppedOne = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (overflow == BLOCK)
+            {
+                spaceAvailable.wait(lock, [this] { return jobs.size() < capacity || stopping; });
+            }
+            else if (jobs.size() >= capacity)
+            {
+                spare.push_back(std::move(jobs.front().frame.pixels));
+                jobs.pop_front();
+                stats.dropped++;
+                droppedOne = true;
+            }
+            jobs.push_back(std::move(job));
+            stats.queued++;
+        }
+        jobAvailable.notify_one();
+        return !droppedOne;
+    }
+
+    // true when another push() would drop or block
+    // ------------------------------------------------------------------------
+    bool full()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return jobs.size() >= capacity;
+    }
+
+    // a recycled pixel buffer (possibly empty) to read the next frame into
+    // ------------------------------------------------------------------------
+    std::vector<unsigned char> takeBuffer()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (spare.empty())
+            return std::vector<unsigned char>();
+        std::vector<unsigned char> buffer = std::move(spare.back());
+        spare.pop_back();
+        return buffer;
+    }
+
+    // hand back a buffer from takeBuffer() that no frame was read into
+    // ------------------------------------------------------------------------
+    void returnBuffer(std::vector<unsigned char>&& buffer)
+    {
+        if (buffer.capacity() == 0)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        spare.push_back(std::move(buffer));
+    }
+
+    // wait until every queued frame has been written
+    // ------------------------------------------------------------------------
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return jobs.empty() && busy == 0; });
+    }
+
+    // finish the queued frames and join the workers
+    // ------------------------------------------------------------------------
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (workers.empty())
+                return;
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        spaceAvailable.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+        stopping = false;
+    }
+
+    const Stats& getStats() const
+    {
+        return stats;
+    }
+
+    void printStats() const
+    {
+        std::cout << "Captures: " << stats.queued << " queued, " << stats.encoded << " encoded, "
+                  << stats.dropped << " dropped, " << stats.failed << " failed, "
+                  << stats.bytesWritten << " bytes written" << std::endl;
+        static const char* tierNames[PNG_TIER_COUNT] = { "default", "fast", "rle", "store" };
+        for (int tier = 0; tier < PNG_TIER_COUNT; tier++)
+        {
+            unsigned long long nanoseconds = stats.tierNanoseconds[tier];
+            if (nanoseconds == 0)
+                continue;
+            double mbPerSec = stats.tierPixelBytes[tier] / (1024.0 * 1024.0) / (nanoseconds * 1e-9);
+            std::cout << "  png " << tierNames[tier] << ": " << mbPerSec << " MB/s" << std::endl;
+        }
+    }
+
+private:
+    int nrWorkers;
+    size_t capacity;
+    Overflow overflow;
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable spaceAvailable;
+    std::condition_variable idle;
+    std::deque<Job> jobs;
+    std::vector<std::vector<unsigned char>> spare;
+    std::vector<std::thread> workers;
+    int busy = 0;
+    bool stopping = false;
+    Stats stats;
+
+    struct FileSink
+    {
+        FILE* file;
+        size_t bytes;
+        bool ok;
+    };
+
+    static void writeToFile(void* context, void* data, int size)
+    {
+        FileSink* sink = (FileSink*)context;
+        if (fwrite(data, 1, size, sink->file) != (size_t)size)
+            sink->ok = false;
+        sink->bytes += size;
+    }
+
+    void start()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!workers.empty())
+            return;
+        for (int i = 0; i < nrWorkers; i++)
+            workers.emplace_back(&CaptureQueue::workerLoop, this);
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobAvailable.wait(lock, [this] { return !jobs.empty() || stopping; });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                busy++;
+            }
+            spaceAvailable.notify_one();
+
+            size_t bytes = 0;
+            auto start = std::chrono::steady_clock::now();
+            bool ok = encode(job, &bytes);
+            if (job.format == PNG)
+            {
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                stats.tierPixelBytes[job.pngTier] += (unsigned long long)job.frame.width * job.frame.height * job.frame.nrChannels;
+                stats.tierNanoseconds[job.pngTier] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+            }
+            if (ok)
+            {
+                stats.encoded++;
+                stats.bytesWritten += bytes;
+            }
+            else
+            {
+                stats.failed++;
+                std::cout << "ERROR::CAPTURE_QUEUE::WRITE_FAILED: " << job.path << std::endl;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                spare.push_back(std::move(job.frame.pixels));
+                busy--;
+            }
+            idle.notify_all();
+        }
+    }
+
+    // stb_image_write compression level for a tier (0 = stored, -1 = RLE only)
+    static int pngLevel(PngTier tier)
+    {
+        switch (tier)
+        {
+        case PNG_FAST:
+            return 1;
+        case PNG_RLE:
+            return -1;
+        case PNG_STORE:
+            return 0;
+        default:
+            return stbi_write_png_compression_level;
+        }
+    }
+
+    // runs on a worker thread; frames arrive bottom-up, so every writer flips
+    bool encode(Job& job, size_t* bytes)
+    {
+        PboReadback::Frame& frame = job.frame;
+        int rowBytes = frame.width * frame.nrChannels;
+
+        // only the PNG writer takes a stride, the others want packed rows
+        if (job.format != PNG && frame.stride != rowBytes)
+        {
+            for (int y = 1; y < frame.height; y++)
+                memmove(&frame.pixels[(size_t)y * rowBytes], &frame.pixels[(size_t)y * frame.stride], rowBytes);
+            frame.stride = rowBytes;
+        }
+
+        FileSink sink = { fopen(job.path.c_str(), "wb"), 0, true };
+        if (!sink.file)
+            return false;
+
+        int result = 0;
+        switch (job.format)
+        {
+        case PNG:
+            result = stbi_write_png_to_func_ex(writeToFile, &sink, frame.width, frame.height, frame.nrChannels,
+                                               frame.pixels.data(), frame.stride, pngLevel(job.pngTier), job.pngFilter);
+            break;
+        case JPG:
+            result = stbi_write_jpg_to_func(writeToFile, &sink, frame.width, frame.height,
+                                            frame.nrChannels, frame.pixels.data(), 90);
+            break;
+        case BMP:
+            result = stbi_write_bmp_to_func(writeToFile, &sink, frame.width, frame.height,
+                                            frame.nrChannels, frame.pixels.data());
+            break;
+        case TGA:
+            result = stbi_write_tga_to_func(writeToFile, &sink, frame.width, frame.height,
+                                            frame.nrChannels, frame.pixels.data());
+            break;
+        }
+        fclose(sink.file);
+        *bytes = sink.bytes;
+        return result != 0 && sink.ok;
+    }
+};
+#endif
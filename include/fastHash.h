@@ -0,0 +1,64 @@
+#ifndef FAST_HASH_H
+#define FAST_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Small non-cryptographic 64-bit hash for bulk pixel data. It consumes eight
+// bytes per step with one multiply and a rotate, so it runs at memory speed
+// on image-sized buffers; it is only meant for telling buffers apart.
+
+static inline uint64_t fastHashMix(uint64_t h, uint64_t word)
+{
+    h ^= word * 0x9E3779B97F4A7C15ull;
+    h = (h << 31) | (h >> 33);
+    return h * 0xC2B2AE3D27D4EB4Full;
+}
+
+static inline uint64_t fastHashFinish(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t fastHashUpdate(uint64_t h, const void* data, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = fastHashMix(h, word);
+        p += 8;
+        size -= 8;
+    }
+    if (size > 0)
+    {
+        uint64_t word = 0;
+        memcpy(&word, p, size);
+        h = fastHashMix(h, word ^ ((uint64_t)size << 56));
+    }
+    return h;
+}
+
+// hash of a contiguous buffer
+static inline uint64_t fastHash64(const void* data, size_t size, uint64_t seed = 0)
+{
+    return fastHashFinish(fastHashUpdate(seed ^ (size * 0x9E3779B97F4A7C15ull), data, size));
+}
+
+// hash of an image's visible bytes, skipping any row padding in the stride
+static inline uint64_t fastHashRows(const void* data, size_t rowBytes, int height, size_t stride, uint64_t seed = 0)
+{
+    const unsigned char* row = (const unsigned char*)data;
+    uint64_t h = seed ^ (rowBytes * 0x9E3779B97F4A7C15ull) ^ (uint64_t)height;
+    for (int y = 0; y < height; y++, row += stride)
+        h = fastHashUpdate(h, row, rowBytes);
+    return fastHashFinish(h);
+}
+#endif
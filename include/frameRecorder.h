@@ -0,0 +1,153 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <frameSequence.h>
+#include <mappedFile.h>
+#include <pboReadback.h>
+
+// Records every rendered frame into one preallocated, memory-mapped
+// frame-sequence file (layout in frameSequence.h). update() is called once
+// per frame after the swap: it starts a readback of that frame through its
+// own PBO ring and copies finished readbacks straight from the mapped PBO
+// into the mapped file, so recording does no per-frame allocation, encoding
+// or write() calls. tools/frameconv turns a recording into PNG/JPG files.
+// All methods must be called on the thread that owns the GL context.
+class FrameRecorder
+{
+public:
+    FrameRecorder(int ringSize = 3)
+        : ring(ringSize)
+    {
+    }
+    ~FrameRecorder()
+    {
+        // the GL objects are gone with the context by now; just close the file
+        if (header)
+            file.close(usedBytes());
+    }
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    // size the file for maxFrames frames of the current viewport and map it
+    // ------------------------------------------------------------------------
+    bool start(const std::string& path, int maxFrames)
+    {
+        if (header)
+            stop();
+
+        GLint pView[4];
+        glGetIntegerv(GL_VIEWPORT, pView);
+        int stride = 3 * pView[2];
+        stride += (stride % 4) ? (4 - stride % 4) : 0;
+
+        FrameSequenceHeader layout;
+        uint64_t fileSize = frameSequenceLayout(layout, pView[2], pView[3], 3, stride, maxFrames);
+        if (!file.create(path, (size_t)fileSize))
+            return false;
+
+        memcpy(file.data(), &layout, sizeof(layout));
+        header = (FrameSequenceHeader*)file.data();
+        timestamps = frameSequenceTimestamps(file.data());
+        dropped = 0;
+        std::cout << "Recording " << layout.width << "x" << layout.height << " to " << path << std::endl;
+        return true;
+    }
+
+    // read back the frame just rendered and store any finished ones
+    // ------------------------------------------------------------------------
+    void update(double now)
+    {
+        if (!header)
+            return;
+
+        store(false);
+        if (header->frameCount + ring.inFlight() >= header->frameCapacity)
+        {
+            // full: finish once the last readbacks have landed
+            if (ring.inFlight() == 0)
+                stop();
+            return;
+        }
+        if (!ring.request(GL_FRONT, now))
+            dropped++;
+    }
+
+    // wait for the outstanding readbacks, then trim and close the file
+    // ------------------------------------------------------------------------
+    void stop()
+    {
+        if (!header)
+            return;
+        store(true);
+        ring.release();
+
+        std::cout << "Recorded " << header->frameCount << " frames";
+        if (dropped > 0)
+            std::cout << " (" << dropped << " dropped)";
+        std::cout << std::endl;
+
+        file.close(usedBytes());
+        header = NULL;
+        timestamps = NULL;
+    }
+
+    bool recording() const
+    {
+        return header != NULL;
+    }
+
+    unsigned long long framesDropped() const
+    {
+        return dropped;
+    }
+
+private:
+    PboReadback ring;
+    MappedFile file;
+    FrameSequenceHeader* header = NULL; // lives in the mapping
+    double* timestamps = NULL;
+    unsigned long long dropped = 0;
+
+    void store(bool wait)
+    {
+        for (;;)
+        {
+            PboReadback::Frame info;
+            uint32_t index = header->frameCount;
+            if (index >= header->frameCapacity)
+            {
+                ring.discardPending();
+                return;
+            }
+            if (ring.inFlight() == 0)
+                return;
+            unsigned char* dst = frameSequenceFrame(file.data(), *header, index);
+            if (!ring.retrieveInto(dst, (size_t)header->frameBytes, info, wait))
+            {
+                if (info.width == 0)
+                    return; // oldest readback not finished yet
+                dropped++; // too big (the window grew) or the map failed
+                continue;
+            }
+            if ((uint32_t)info.width != header->width || (uint32_t)info.height != header->height)
+            {
+                dropped++;
+                continue;
+            }
+            timestamps[index] = info.timestamp;
+            header->frameCount = index + 1;
+        }
+    }
+
+    size_t usedBytes() const
+    {
+        return (size_t)(header->dataOffset + header->frameBytes * header->frameCount);
+    }
+};
+#endif
@@ -0,0 +1,73 @@
+#ifndef FRAME_SEQUENCE_H
+#define FRAME_SEQUENCE_H
+
+#include <cstdint>
+#include <cstring>
+
+// On-disk layout of a raw frame recording (see FrameRecorder and
+// tools/frameconv.cpp), all little-endian as written by the host:
+//
+//   FrameSequenceHeader
+//   double timestamps[frameCapacity]   glfwGetTime() when each frame was read
+//   frame 0, frame 1, ...              frameBytes each, from dataOffset on
+//
+// Frames are the raw glReadPixels rows: RGB, bottom-up, rowStride bytes
+// apart. Only the first frameCount frames are valid.
+struct FrameSequenceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t nrChannels;
+    uint32_t rowStride;
+    uint32_t frameCapacity;
+    uint32_t frameCount;
+    uint32_t reserved;
+    uint64_t frameBytes;
+    uint64_t dataOffset;
+};
+
+static const char FRAME_SEQUENCE_MAGIC[8] = { 'F', 'R', 'A', 'M', 'E', 'S', 'E', 'Q' };
+static const uint32_t FRAME_SEQUENCE_VERSION = 1;
+
+// fill in a header and return the total file size for frameCapacity frames;
+// frame data starts on a 4K boundary so every frame is page aligned as well
+// when frameBytes is a multiple of the page size
+inline uint64_t frameSequenceLayout(FrameSequenceHeader& header, int width, int height, int nrChannels,
+                                    int rowStride, int frameCapacity)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FRAME_SEQUENCE_MAGIC, sizeof(header.magic));
+    header.version = FRAME_SEQUENCE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.nrChannels = nrChannels;
+    header.rowStride = rowStride;
+    header.frameCapacity = frameCapacity;
+    header.frameBytes = (uint64_t)rowStride * height;
+    header.dataOffset = (sizeof(FrameSequenceHeader) + sizeof(double) * frameCapacity + 4095) & ~(uint64_t)4095;
+    return header.dataOffset + header.frameBytes * frameCapacity;
+}
+
+// true if header describes a file of fileSize bytes this code can read
+inline bool frameSequenceValid(const FrameSequenceHeader& header, uint64_t fileSize)
+{
+    return memcmp(header.magic, FRAME_SEQUENCE_MAGIC, sizeof(header.magic)) == 0 &&
+           header.version == FRAME_SEQUENCE_VERSION && header.frameCount <= header.frameCapacity &&
+           header.rowStride >= (uint64_t)header.width * header.nrChannels &&
+           header.frameBytes == (uint64_t)header.rowStride * header.height &&
+           header.dataOffset >= sizeof(FrameSequenceHeader) + sizeof(double) * header.frameCapacity &&
+           header.dataOffset + header.frameBytes * header.frameCount <= fileSize;
+}
+
+inline double* frameSequenceTimestamps(unsigned char* base)
+{
+    return (double*)(base + sizeof(FrameSequenceHeader));
+}
+
+inline unsigned char* frameSequenceFrame(unsigned char* base, const FrameSequenceHeader& header, uint32_t index)
+{
+    return base + header.dataOffset + header.frameBytes * index;
+}
+#endif
@@ -0,0 +1,142 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A whole file mapped into memory (POSIX mmap). create() makes or replaces a
+// file of a fixed size and maps it read/write, so writers just store into
+// data() with no per-write system call; open() maps an existing file
+// read-only, optionally telling the kernel it will be read front to back so
+// it reads ahead instead of faulting in one page at a time. close() (or the
+// destructor) unmaps, optionally cutting a writable file down to the bytes
+// actually used. Only regular files can be mapped; see isMappable().
+class MappedFile
+{
+public:
+    MappedFile()
+    {
+    }
+    ~MappedFile()
+    {
+        close();
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // ------------------------------------------------------------------------
+    bool create(const std::string& path, size_t size)
+    {
+        close();
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)size) != 0 || !map(size, PROT_READ | PROT_WRITE))
+        {
+            std::cout << "ERROR::MAPPED_FILE::CREATE_FAILED: " << path << std::endl;
+            close();
+            return false;
+        }
+        writable = true;
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool open(const std::string& path, bool sequential = false)
+    {
+        close();
+        struct stat info;
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0 || fstat(fd, &info) != 0 || info.st_size <= 0 || !map((size_t)info.st_size, PROT_READ))
+        {
+            std::cout << "ERROR::MAPPED_FILE::OPEN_FAILED: " << path << std::endl;
+            close();
+            return false;
+        }
+        if (sequential)
+        {
+            // only hints: a kernel that ignores them still serves the pages
+            madvise(mapping, length, MADV_SEQUENTIAL);
+            madvise(mapping, length, MADV_WILLNEED);
+        }
+        return true;
+    }
+
+    // a non-empty regular file, so open() can map it; pipes, sockets and
+    // devices have to be read instead
+    static bool isMappable(const std::string& path)
+    {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0;
+    }
+
+    // size and modification time (nanoseconds since the epoch) of a regular
+    // file, to tell whether something derived from it is still current
+    static bool fileStamp(const std::string& path, uint64_t& size, int64_t& mtime)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            return false;
+#ifdef __APPLE__
+        const struct timespec& modified = info.st_mtimespec;
+#else
+        const struct timespec& modified = info.st_mtim;
+#endif
+        size = (uint64_t)info.st_size;
+        mtime = (int64_t)modified.tv_sec * 1000000000 + modified.tv_nsec;
+        return true;
+    }
+
+    // unmap; a writable file is truncated to keepBytes if that is smaller
+    // ------------------------------------------------------------------------
+    void close(size_t keepBytes = (size_t)-1)
+    {
+        if (mapping)
+            munmap(mapping, length);
+        if (fd >= 0)
+        {
+            if (writable && keepBytes < length && ftruncate(fd, (off_t)keepBytes) != 0)
+                std::cout << "ERROR::MAPPED_FILE::TRUNCATE_FAILED" << std::endl;
+            ::close(fd);
+        }
+        mapping = NULL;
+        length = 0;
+        fd = -1;
+        writable = false;
+    }
+
+    unsigned char* data() const
+    {
+        return mapping;
+    }
+    size_t size() const
+    {
+        return length;
+    }
+    bool isOpen() const
+    {
+        return mapping != NULL;
+    }
+
+private:
+    unsigned char* mapping = NULL;
+    size_t length = 0;
+    int fd = -1;
+    bool writable = false;
+
+    bool map(size_t size, int protection)
+    {
+        void* p = mmap(NULL, size, protection, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            return false;
+        mapping = (unsigned char*)p;
+        length = size;
+        return true;
+    }
+};
+#endif
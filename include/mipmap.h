@@ -0,0 +1,668 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <threadPool.h>
+
+// CPU mip chain generation, so mips come out the same on every driver and
+// can be baked offline (tools/texbake.cpp). mipGenerate() takes 8-bit,
+// 16-bit or float images as stb_image decodes them and builds each level
+// from the one above it, in linear float: sRGB colour is decoded first and
+// encoded again per level (alpha never is), and levels below the first are
+// read from the float copy, so rounding doesn't pile up down the chain. Each
+// level halves the one above it (rounding down, never below 1); the filter
+// is a box over the pixels each output pixel covers (an exact 2x2 average
+// for even sizes) or a Kaiser-windowed sinc. Bands of output rows run over
+// a ThreadPool; the vertical pass, which does most of the work, has SSE2 and
+// AVX2 kernels, the horizontal one SSE2 for 3 and 4 channels. The exact 2x2
+// box has an SSE2 kernel of its own for both passes, which keeps the linear
+// 8-bit chain at least as fast as mipDownsample's integer boxes (imgbench
+// mips compares the two).
+//
+// SSE2 is used whenever the compiler targets it; the AVX2 kernel is compiled
+// for that target on its own and only runs if the CPU supports it. Both use
+// separate multiplies and adds, no FMA, so they give the scalar loops'
+// results. #define MIPMAP_NO_SIMD to build the scalar loops only, or turn
+// the kernels off at run time with mipSimdEnabled() (not while mipGenerate
+// runs), which imgbench does to check one against the other.
+inline bool& mipSimdEnabled()
+{
+    static bool enabled = true;
+    return enabled;
+}
+
+#if !defined(MIPMAP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MIPMAP_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define MIPMAP_AVX2
+#define MIPMAP_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+inline bool mipAvx2Detect()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+}
+#elif defined(_MSC_VER) && _MSC_VER >= 1700
+#define MIPMAP_AVX2
+#define MIPMAP_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+inline bool mipAvx2Detect()
+{
+    int info[4];
+    __cpuid(info, 1);
+    // AVX state must be enabled by the OS (OSXSAVE + XCR0 bits 1,2)
+    if (!((info[2] >> 27) & 1) || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return ((info[1] >> 5) & 1) != 0;
+}
+#endif
+#ifdef MIPMAP_AVX2
+inline bool mipAvx2Available()
+{
+    static const bool available = mipAvx2Detect();
+    return available;
+}
+#endif
+#endif
+
+enum MipFilter
+{
+    MIP_BOX,   // average of the pixels each output pixel covers
+    MIP_KAISER // Kaiser-windowed sinc, 3 output pixels each way: sharper, with slight ringing
+};
+
+struct MipSettings
+{
+    MipFilter filter = MIP_BOX;
+    // 8- and 16-bit colour channels are sRGB-encoded: filter in linear light.
+    // The alpha channel (last of 2 or 4) and float images are always linear
+    bool srgb = false;
+};
+
+// levels in a full chain down to 1x1, level 0 included
+inline int mipLevelCount(int width, int height)
+{
+    int levels = 1;
+    for (int size = std::max(width, height); size > 1; size >>= 1)
+        levels++;
+    return levels;
+}
+
+inline int mipLevelSize(int size, int level)
+{
+    return std::max(size >> level, 1);
+}
+
+// bytes in a full chain, level 0 included, with the levels one after another
+inline size_t mipChainSize(int width, int height, int nrChannels, int bitsPerChannel)
+{
+    size_t bytes = 0;
+    for (int i = 0; i < mipLevelCount(width, height); i++)
+        bytes += (size_t)mipLevelSize(width, i) * mipLevelSize(height, i) * nrChannels * (bitsPerChannel / 8);
+    return bytes;
+}
+
+// The naive scalar version, for comparison: dst (width/2 x height/2, at
+// least 1x1) from 8-bit src with an integer 2x2 box in the encoded values,
+// an odd last row or column folded into the pixels next to it
+inline void mipDownsample(const unsigned char* src, int width, int height, int nrChannels, unsigned char* dst)
+{
+    int dstWidth = std::max(width / 2, 1);
+    int dstHeight = std::max(height / 2, 1);
+    size_t srcStride = (size_t)width * nrChannels;
+    for (int y = 0; y < dstHeight; y++)
+    {
+        const unsigned char* row0 = src + (size_t)std::min(2 * y, height - 1) * srcStride;
+        const unsigned char* row1 = src + (size_t)std::min(2 * y + 1, height - 1) * srcStride;
+        // an odd last row has no partner below; take it into the last output row
+        const unsigned char* row2 = (height & 1) && height > 1 && y == dstHeight - 1 ? row1 + srcStride : NULL;
+        unsigned char* out = dst + (size_t)y * dstWidth * nrChannels;
+        for (int x = 0; x < dstWidth; x++)
+        {
+            int x0 = std::min(2 * x, width - 1) * nrChannels;
+            int x1 = std::min(2 * x + 1, width - 1) * nrChannels;
+            int x2 = (width & 1) && width > 1 && x == dstWidth - 1 ? x1 + nrChannels : -1;
+            for (int c = 0; c < nrChannels; c++)
+            {
+                int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                int count = 4;
+                if (x2 >= 0)
+                {
+                    sum += row0[x2 + c] + row1[x2 + c];
+                    count += 2;
+                }
+                if (row2)
+                {
+                    sum += row2[x0 + c] + row2[x1 + c] + (x2 >= 0 ? row2[x2 + c] : 0);
+                    count += x2 >= 0 ? 3 : 2;
+                }
+                out[x * nrChannels + c] = (unsigned char)((sum + count / 2) / count);
+            }
+        }
+    }
+}
+
+inline float mipSrgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float mipLinearToSrgb(float l)
+{
+    return l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+}
+
+// 8-bit values to linear float both ways. sRGB encoding looks up the code
+// at the start of the value's 1/4096 step and steps past at most one
+// threshold halfway between codes (the curve rises less than a code per
+// step), so it rounds to the nearest code without a pow per value
+struct MipSrgbTables
+{
+    static const int STEPS = 4096;
+    float linear8[256];
+    float decode8[256];
+    float threshold8[256]; // linear value at code k + 0.5; past 1 for 255
+    unsigned char start8[STEPS + 1];
+
+    MipSrgbTables()
+    {
+        for (int k = 0; k < 256; k++)
+        {
+            linear8[k] = k * (1.0f / 255.0f); // as the SSE2 decode scales
+            decode8[k] = mipSrgbToLinear(k / 255.0f);
+            threshold8[k] = k < 255 ? mipSrgbToLinear((k + 0.5f) / 255.0f) : 2.0f;
+        }
+        int code = 0;
+        for (int i = 0; i <= STEPS; i++)
+        {
+            while ((float)i / STEPS >= threshold8[code])
+                code++;
+            start8[i] = (unsigned char)code;
+        }
+    }
+
+    // l in [0, 1]
+    unsigned char encode8(float l) const
+    {
+        int code = start8[(int)(l * STEPS)];
+        return (unsigned char)(code + (l >= threshold8[code]));
+    }
+};
+
+inline const MipSrgbTables& mipSrgbTables()
+{
+    static const MipSrgbTables tables;
+    return tables;
+}
+
+// 16-bit sRGB to linear, built the first time a 16-bit sRGB image comes by
+inline const float* mipSrgbDecode16()
+{
+    static const std::vector<float> table = [] {
+        std::vector<float> decoded(65536);
+        for (int k = 0; k < 65536; k++)
+            decoded[k] = mipSrgbToLinear(k / 65535.0f);
+        return decoded;
+    }();
+    return table.data();
+}
+
+// the source pixels that make up each output pixel along one axis, and
+// their weights; shorter lists are padded with zero weights
+struct MipTaps
+{
+    int taps = 0;               // per output pixel
+    std::vector<int> index;     // taps per output pixel, clamped to the edge
+    std::vector<float> weights; // taps per output pixel, summing to 1
+};
+
+inline double mipBesselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+inline MipTaps mipTaps(int srcSize, int dstSize, MipFilter filter)
+{
+    const double radius = 3.0, alpha = 4.0; // radius in output pixels
+    const double pi = 3.14159265358979323846;
+    double scale = (double)srcSize / dstSize;
+    std::vector<std::vector<std::pair<int, double>>> lists(dstSize);
+    for (int x = 0; x < dstSize; x++)
+    {
+        std::vector<std::pair<int, double>>& list = lists[x];
+        if (filter == MIP_BOX)
+        {
+            double lo = x * scale, hi = (x + 1) * scale;
+            for (int i = (int)std::floor(lo); i < (int)std::ceil(hi); i++)
+            {
+                double covered = std::min(hi, i + 1.0) - std::max(lo, (double)i);
+                if (covered > 1e-9)
+                    list.push_back({ i, covered });
+            }
+        }
+        else
+        {
+            double center = (x + 0.5) * scale;
+            for (int i = (int)std::floor(center - radius * scale); i <= (int)std::ceil(center + radius * scale); i++)
+            {
+                double t = (i + 0.5 - center) / scale;
+                if (std::fabs(t) >= radius)
+                    continue;
+                double u = t / radius;
+                double sinc = t == 0.0 ? 1.0 : std::sin(pi * t) / (pi * t);
+                double window = mipBesselI0(alpha * std::sqrt(1.0 - u * u)) / mipBesselI0(alpha);
+                list.push_back({ std::min(std::max(i, 0), srcSize - 1), sinc * window });
+            }
+        }
+    }
+
+    MipTaps result;
+    for (const auto& list : lists)
+        result.taps = std::max(result.taps, (int)list.size());
+    result.index.resize((size_t)dstSize * result.taps);
+    result.weights.resize((size_t)dstSize * result.taps);
+    for (int x = 0; x < dstSize; x++)
+    {
+        double total = 0.0;
+        for (const auto& tap : lists[x])
+            total += tap.second;
+        for (int k = 0; k < result.taps; k++)
+        {
+            bool used = k < (int)lists[x].size();
+            result.index[(size_t)x * result.taps + k] = used ? lists[x][k].first : lists[x].back().first;
+            result.weights[(size_t)x * result.taps + k] = used ? (float)(lists[x][k].second / total) : 0.0f;
+        }
+    }
+    return result;
+}
+
+#ifdef MIPMAP_AVX2
+// the part of mipVertical() that fits 8 lanes at a time; returns how far it got
+MIPMAP_TARGET_AVX2 inline int mipVerticalAvx2(const float* const* rows, const float* weights, int taps, int count,
+                                              float* out)
+{
+    int j = 0;
+    for (; j + 8 <= count; j += 8)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < taps; k++)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + j), _mm256_set1_ps(weights[k])));
+        _mm256_storeu_ps(out + j, sum);
+    }
+    return j;
+}
+#endif
+
+// out[j] = the weighted sum of rows[k][j] over the taps
+inline void mipVertical(const float* const* rows, const float* weights, int taps, int count, float* out)
+{
+    int j = 0;
+#ifdef MIPMAP_SSE2
+    const int simdCount = mipSimdEnabled() ? count : 0;
+#endif
+#ifdef MIPMAP_AVX2
+    if (mipAvx2Available())
+        j = mipVerticalAvx2(rows, weights, taps, simdCount, out);
+#endif
+#ifdef MIPMAP_SSE2
+    for (; j + 4 <= simdCount; j += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < taps; k++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + j), _mm_set1_ps(weights[k])));
+        _mm_storeu_ps(out + j, sum);
+    }
+#endif
+    for (; j < count; j++)
+    {
+        float sum = 0.0f;
+        for (int k = 0; k < taps; k++)
+            sum += rows[k][j] * weights[k];
+        out[j] = sum;
+    }
+}
+
+// one row across: dstWidth pixels from the source row in. With SSE2, 3- and
+// 4-channel pixels are filtered four floats at a time, so in and out need a
+// float of slack past their last pixel
+inline void mipHorizontal(const float* in, const MipTaps& taps, int nrChannels, int dstWidth, float* out)
+{
+    const int* index = taps.index.data();
+    const float* weights = taps.weights.data();
+#ifdef MIPMAP_SSE2
+    if (mipSimdEnabled() && (nrChannels == 3 || nrChannels == 4))
+    {
+        for (int x = 0; x < dstWidth; x++, index += taps.taps, weights += taps.taps)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps.taps; k++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(in + index[k] * nrChannels), _mm_set1_ps(weights[k])));
+            _mm_storeu_ps(out + x * nrChannels, sum);
+        }
+        return;
+    }
+#endif
+    for (int x = 0; x < dstWidth; x++, index += taps.taps, weights += taps.taps)
+        for (int c = 0; c < nrChannels; c++)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < taps.taps; k++)
+                sum += in[index[k] * nrChannels + c] * weights[k];
+            out[x * nrChannels + c] = sum;
+        }
+}
+
+// The box filter when a level halves both ways: each output pixel is the
+// 2x2 pixels under it, from source rows row0 and row1. The multiplies and
+// adds are mipVertical's and mipHorizontal's with their weights of 0.5, so
+// the result is the same to the bit, without going through the tap lists
+// or a column in between. out is written exactly, no slack needed
+inline void mipHalveRow(const float* row0, const float* row1, int nrChannels, int dstWidth, float* out)
+{
+    const int n = nrChannels;
+    int x = 0;
+#ifdef MIPMAP_SSE2
+    const bool simd = mipSimdEnabled();
+    const __m128 half = _mm_set1_ps(0.5f);
+    auto down = [&](int i) {
+        return _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(row0 + i), half), _mm_mul_ps(_mm_loadu_ps(row1 + i), half));
+    };
+    auto across = [&](__m128 a, __m128 b) { return _mm_add_ps(_mm_mul_ps(a, half), _mm_mul_ps(b, half)); };
+    if (simd && n == 1)
+    {
+        for (; x + 4 <= dstWidth; x += 4)
+        {
+            __m128 a = down(2 * x), b = down(2 * x + 4);
+            _mm_storeu_ps(out + x, across(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+                                          _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+        }
+    }
+    else if (simd && n == 2)
+    {
+        for (; x + 2 <= dstWidth; x += 2)
+        {
+            __m128 a = down(4 * x), b = down(4 * x + 4);
+            _mm_storeu_ps(out + 2 * x, across(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 1, 0)),
+                                              _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 2, 3, 2))));
+        }
+    }
+    else if (simd && n == 4)
+    {
+        for (; x < dstWidth; x++)
+            _mm_storeu_ps(out + 4 * x, across(down(8 * x), down(8 * x + 4)));
+    }
+    else if (simd)
+    {
+        // four floats a pixel: each store's last lane is the next pixel's
+        // first, written again after; the last pixel is left to the loop
+        // below so nothing is read or written past either row
+        for (; x + 1 < dstWidth; x++)
+            _mm_storeu_ps(out + 3 * x, across(down(6 * x), down(6 * x + 3)));
+    }
+#endif
+    for (; x < dstWidth; x++)
+        for (int c = 0; c < n; c++)
+        {
+            int i = 2 * x * n + c;
+            float a = row0[i] * 0.5f + row1[i] * 0.5f;
+            float b = row0[i + n] * 0.5f + row1[i + n] * 0.5f;
+            out[x * n + c] = a * 0.5f + b * 0.5f;
+        }
+}
+
+// true for the channels that get gamma: all but alpha, if settings.srgb
+inline bool mipSrgbChannel(int c, int nrChannels, int bitsPerChannel, const MipSettings& settings)
+{
+    bool alpha = (nrChannels == 2 || nrChannels == 4) && c == nrChannels - 1;
+    return settings.srgb && bitsPerChannel != 32 && !alpha;
+}
+
+// the 8-bit row loops, with the channel count known to the compiler
+template <int N>
+inline void mipDecodeRow8(const unsigned char* in, int count, const float* const* channelTables, float* out)
+{
+    // a copy the stores to out can't alias
+    const float* tables[N];
+    for (int c = 0; c < N; c++)
+        tables[c] = channelTables[c];
+    for (int j = 0; j < count; j += N)
+        for (int c = 0; c < N; c++)
+            out[j + c] = tables[c][in[j + c]];
+}
+
+template <int N>
+inline void mipEncodeRow8(const float* in, int count, const bool* srgb, unsigned char* out)
+{
+    const MipSrgbTables& tables = mipSrgbTables();
+    for (int j = 0; j < count; j += N)
+        for (int c = 0; c < N; c++)
+        {
+            float v = std::min(std::max(in[j + c], 0.0f), 1.0f);
+            out[j + c] = srgb[c] ? tables.encode8(v) : (unsigned char)(v * 255.0f + 0.5f);
+        }
+}
+
+// count values of an 8- or 16-bit row into linear float
+inline void mipDecodeRow(const void* in, int count, int nrChannels, int bitsPerChannel, const MipSettings& settings,
+                         float* out)
+{
+    bool srgb[4];
+    bool anySrgb = false;
+    for (int c = 0; c < nrChannels; c++)
+        anySrgb |= srgb[c] = mipSrgbChannel(c, nrChannels, bitsPerChannel, settings);
+    if (bitsPerChannel == 8)
+    {
+        const MipSrgbTables& tables = mipSrgbTables();
+        const float* channelTables[4];
+        for (int c = 0; c < nrChannels; c++)
+            channelTables[c] = srgb[c] ? tables.decode8 : tables.linear8;
+        const unsigned char* values = (const unsigned char*)in;
+        int j = 0;
+#ifdef MIPMAP_SSE2
+        // every channel linear: 16 at a time, widened and scaled
+        if (!anySrgb && mipSimdEnabled())
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+            for (; j + 16 <= count; j += 16)
+            {
+                __m128i bytes = _mm_loadu_si128((const __m128i*)(values + j));
+                __m128i lo = _mm_unpacklo_epi8(bytes, zero), hi = _mm_unpackhi_epi8(bytes, zero);
+                __m128i words[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                                     _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+                for (int k = 0; k < 4; k++)
+                    _mm_storeu_ps(out + j + 4 * k, _mm_mul_ps(_mm_cvtepi32_ps(words[k]), scale));
+            }
+        }
+#endif
+        // as in mipEncodeRow, linear channels don't care where that stopped
+        if (!anySrgb)
+            nrChannels = 1;
+        values += j;
+        out += j;
+        count -= j;
+        switch (nrChannels)
+        {
+            case 1: mipDecodeRow8<1>(values, count, channelTables, out); break;
+            case 2: mipDecodeRow8<2>(values, count, channelTables, out); break;
+            case 3: mipDecodeRow8<3>(values, count, channelTables, out); break;
+            default: mipDecodeRow8<4>(values, count, channelTables, out); break;
+        }
+    }
+    else
+    {
+        const uint16_t* values = (const uint16_t*)in;
+        const float* decode16 = settings.srgb ? mipSrgbDecode16() : NULL;
+        for (int j = 0, c = 0; j < count; j++, c = c + 1 == nrChannels ? 0 : c + 1)
+            out[j] = srgb[c] ? decode16[values[j]] : values[j] * (1.0f / 65535.0f);
+    }
+}
+
+// and back, clamped to the type's range (a Kaiser filter overshoots a little)
+inline void mipEncodeRow(const float* in, int count, int nrChannels, int bitsPerChannel, const MipSettings& settings,
+                         void* out)
+{
+    bool srgb[4];
+    bool anySrgb = false;
+    for (int c = 0; c < nrChannels; c++)
+        anySrgb |= srgb[c] = mipSrgbChannel(c, nrChannels, bitsPerChannel, settings);
+    if (bitsPerChannel == 8)
+    {
+        unsigned char* values = (unsigned char*)out;
+        int j = 0;
+#ifdef MIPMAP_SSE2
+        // every channel linear: 16 at a time, the clamp done by the packs
+        if (!anySrgb && mipSimdEnabled())
+        {
+            const __m128 scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps();
+            for (; j + 16 <= count; j += 16)
+            {
+                __m128i v[4];
+                for (int k = 0; k < 4; k++)
+                {
+                    __m128 clamped = _mm_max_ps(_mm_loadu_ps(in + j + 4 * k), zero);
+                    v[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(clamped, scale), half));
+                }
+                __m128i lo = _mm_packs_epi32(v[0], v[1]), hi = _mm_packs_epi32(v[2], v[3]);
+                _mm_storeu_si128((__m128i*)(values + j), _mm_packus_epi16(lo, hi));
+            }
+        }
+#endif
+        // linear channels all round the same way, wherever the SIMD loop stopped
+        if (!anySrgb)
+            nrChannels = 1;
+        switch (nrChannels)
+        {
+            case 1: mipEncodeRow8<1>(in + j, count - j, srgb, values + j); break;
+            case 2: mipEncodeRow8<2>(in + j, count - j, srgb, values + j); break;
+            case 3: mipEncodeRow8<3>(in + j, count - j, srgb, values + j); break;
+            default: mipEncodeRow8<4>(in + j, count - j, srgb, values + j); break;
+        }
+    }
+    else if (bitsPerChannel == 16)
+    {
+        uint16_t* values = (uint16_t*)out;
+        for (int j = 0, c = 0; j < count; j++, c = c + 1 == nrChannels ? 0 : c + 1)
+        {
+            float v = std::min(std::max(in[j], 0.0f), 1.0f);
+            values[j] = (uint16_t)((srgb[c] ? mipLinearToSrgb(v) : v) * 65535.0f + 0.5f);
+        }
+    }
+    else
+    {
+        float* values = (float*)out;
+        for (int j = 0; j < count; j++)
+            values[j] = std::max(in[j], 0.0f);
+    }
+}
+
+// Fill levels[1 .. levelCount-1] from levels[0], a width x height image of
+// nrChannels (1 to 4) at bitsPerChannel 8, 16 or 32 (float), all tightly
+// packed; level i is mipLevelSize(width, i) x mipLevelSize(height, i). Runs
+// on pool when given, which may be the pool the caller itself runs on
+// ----------------------------------------------------------------------------
+inline void mipGenerate(void* const* levels, int levelCount, int width, int height, int nrChannels,
+                        int bitsPerChannel, const MipSettings& settings = MipSettings(), ThreadPool* pool = NULL)
+{
+    const int n = nrChannels;
+    const size_t valueBytes = bitsPerChannel / 8;
+    std::vector<float> above, below; // the level being read and the one being written, in linear float
+    for (int level = 1; level < levelCount; level++)
+    {
+        const int srcWidth = mipLevelSize(width, level - 1), srcHeight = mipLevelSize(height, level - 1);
+        const int dstWidth = mipLevelSize(width, level), dstHeight = mipLevelSize(height, level);
+        const size_t srcStride = (size_t)srcWidth * n, dstStride = (size_t)dstWidth * n;
+        const MipTaps across = mipTaps(srcWidth, dstWidth, settings.filter);
+        const MipTaps down = mipTaps(srcHeight, dstHeight, settings.filter);
+        // level 0 is read as given if it is float, else decoded band by band
+        const bool decode = level == 1 && bitsPerChannel != 32;
+        const float* in = level > 1 ? above.data() : decode ? NULL : (const float*)levels[0];
+        const bool last = level == levelCount - 1;
+        const bool halve = settings.filter == MIP_BOX && srcWidth == 2 * dstWidth && srcHeight == 2 * dstHeight;
+        if (!last)
+            below.resize(dstStride * dstHeight);
+        unsigned char* out = (unsigned char*)levels[level];
+
+        auto band = [&](int y0, int y1) {
+            int first = srcHeight, end = 0;
+            for (size_t i = (size_t)y0 * down.taps; i < (size_t)y1 * down.taps; i++)
+            {
+                first = std::min(first, down.index[i]);
+                end = std::max(end, down.index[i] + 1);
+            }
+            // per thread, so bands after the first don't allocate
+            static thread_local std::vector<float> decoded, column, row;
+            static thread_local std::vector<const float*> rows;
+            // halving reads each source row once, so rows are decoded as they
+            // are needed and stay in cache; other filters share rows between
+            // output rows and decode the band up front
+            if (decode && halve)
+            {
+                decoded.resize(2 * srcStride);
+            }
+            else if (decode)
+            {
+                decoded.resize((size_t)(end - first) * srcStride);
+                for (int y = first; y < end; y++)
+                    mipDecodeRow((const unsigned char*)levels[0] + y * srcStride * valueBytes, (int)srcStride, n,
+                                 bitsPerChannel, settings, &decoded[(y - first) * srcStride]);
+            }
+            column.resize(srcStride + 1);
+            row.resize(dstStride + 1);
+            rows.resize(down.taps);
+            for (int y = y0; y < y1; y++)
+            {
+                for (int k = 0; k < down.taps; k++)
+                {
+                    int source = down.index[(size_t)y * down.taps + k];
+                    if (decode && halve)
+                        mipDecodeRow((const unsigned char*)levels[0] + source * srcStride * valueBytes, (int)srcStride,
+                                     n, bitsPerChannel, settings, &decoded[k * srcStride]);
+                    rows[k] = decode ? &decoded[(halve ? k : source - first) * srcStride] : in + source * srcStride;
+                }
+                // the next level reads this one's floats from below
+                float* result = last ? row.data() : &below[y * dstStride];
+                if (halve)
+                {
+                    mipHalveRow(rows[0], rows[1], n, dstWidth, result);
+                }
+                else
+                {
+                    mipVertical(rows.data(), &down.weights[(size_t)y * down.taps], down.taps, (int)srcStride,
+                                column.data());
+                    mipHorizontal(column.data(), across, n, dstWidth, row.data());
+                    if (!last)
+                        memcpy(result, row.data(), dstStride * sizeof(float));
+                }
+                mipEncodeRow(result, (int)dstStride, n, bitsPerChannel, settings, out + y * dstStride * valueBytes);
+            }
+        };
+
+        // bands of 16 rows keep a decoded band of level 0 in cache; small
+        // levels aren't worth handing out
+        const int bandRows = 16;
+        int bands = (dstHeight + bandRows - 1) / bandRows;
+        auto runBand = [&](int i) { band(i * bandRows, std::min((i + 1) * bandRows, dstHeight)); };
+        if (pool && dstStride * dstHeight >= 65536)
+            pool->parallelFor(bands, runBand);
+        else
+            for (int i = 0; i < bands; i++)
+                runBand(i);
+        above.swap(below);
+    }
+}
+#endif
@@ -0,0 +1,222 @@
+#ifndef PBO_READBACK_H
+#define PBO_READBACK_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Asynchronous framebuffer readback through a ring of pixel pack buffers.
+// request() starts a glReadPixels into the next free PBO and drops a fence
+// behind it; retrieve() hands back the oldest capture once its fence has
+// signaled, usually a couple of frames later, so the render thread never
+// waits on the GPU the way a plain glReadPixels into client memory does.
+class PboReadback
+{
+public:
+    // a finished readback, rows bottom-up as OpenGL returns them
+    struct Frame
+    {
+        int width = 0;
+        int height = 0;
+        int nrChannels = 3;
+        int stride = 0;
+        double timestamp = 0.0; // as passed to request()
+        std::vector<unsigned char> pixels;
+    };
+
+    PboReadback(int ringSize = 3)
+        : slots(ringSize < 2 ? 2 : ringSize)
+    {
+    }
+    PboReadback(const PboReadback&) = delete;
+    PboReadback& operator=(const PboReadback&) = delete;
+
+    // queue a readback of the current viewport from readBuffer; returns false
+    // when every slot is still in flight (the caller should retrieve() first)
+    // ------------------------------------------------------------------------
+    bool request(GLenum readBuffer = GL_FRONT, double timestamp = 0.0)
+    {
+        if (!initialized)
+            init();
+
+        Slot& slot = slots[head];
+        if (slot.fence)
+            return false;
+
+        GLint pView[4];
+        glGetIntegerv(GL_VIEWPORT, pView);
+        slot.width = pView[2];
+        slot.height = pView[3];
+        slot.stride = 3 * slot.width;
+        slot.stride += (slot.stride % 4) ? (4 - slot.stride % 4) : 0;
+
+        GLsizeiptr bufferSize = (GLsizeiptr)slot.stride * slot.height;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        if (bufferSize > slot.capacity)
+        {
+            // orphan and grow; only happens on the first capture or after a resize
+            glBufferData(GL_PIXEL_PACK_BUFFER, bufferSize, NULL, GL_STREAM_READ);
+            slot.capacity = bufferSize;
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadBuffer(readBuffer);
+        glReadPixels(0, 0, slot.width, slot.height, GL_RGB, GL_UNSIGNED_BYTE, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.timestamp = timestamp;
+        head = (head + 1) % (int)slots.size();
+        pending++;
+        return true;
+    }
+
+    // copy out the oldest capture if the GPU has finished it; never blocks
+    // unless wait is set, in which case it waits for that one capture
+    // ------------------------------------------------------------------------
+    bool retrieve(Frame& out, bool wait = false)
+    {
+        Slot* slot = finished(wait);
+        if (!slot)
+            return false;
+        describe(*slot, out);
+        out.pixels.resize((size_t)slot->stride * slot->height);
+        return copyOut(out.pixels.data());
+    }
+
+    // like retrieve(), but the rows go straight into caller memory (e.g. a
+    // mapped file) instead of out.pixels; a capture larger than capacity is
+    // dropped and false returned, with out still describing it
+    // ------------------------------------------------------------------------
+    bool retrieveInto(unsigned char* dst, size_t capacity, Frame& out, bool wait = false)
+    {
+        Slot* slot = finished(wait);
+        if (!slot)
+            return false;
+        describe(*slot, out);
+        if ((size_t)slot->stride * slot->height > capacity)
+        {
+            pop();
+            return false;
+        }
+        return copyOut(dst);
+    }
+
+    // block until every queued capture is done and drop them
+    // ------------------------------------------------------------------------
+    void discardPending()
+    {
+        while (pending > 0)
+        {
+            Slot& slot = slots[tail];
+            glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(slot.fence);
+            slot.fence = 0;
+            tail = (tail + 1) % (int)slots.size();
+            pending--;
+        }
+    }
+
+    int inFlight() const
+    {
+        return pending;
+    }
+
+    // free the GL objects; must be called while the context is still current
+    // ------------------------------------------------------------------------
+    void release()
+    {
+        if (!initialized)
+            return;
+        discardPending();
+        for (Slot& slot : slots)
+        {
+            glDeleteBuffers(1, &slot.pbo);
+            slot.pbo = 0;
+            slot.capacity = 0;
+        }
+        head = tail = 0;
+        initialized = false;
+    }
+
+private:
+    struct Slot
+    {
+        unsigned int pbo = 0;
+        GLsync fence = 0;
+        GLsizeiptr capacity = 0;
+        int width = 0;
+        int height = 0;
+        int stride = 0;
+        double timestamp = 0.0;
+    };
+
+    std::vector<Slot> slots;
+    int head = 0;    // next slot to read into
+    int tail = 0;    // oldest slot still in flight
+    int pending = 0;
+    bool initialized = false;
+
+    void init()
+    {
+        for (Slot& slot : slots)
+            glGenBuffers(1, &slot.pbo);
+        initialized = true;
+    }
+
+    // the oldest slot if its fence has signaled, else NULL
+    Slot* finished(bool wait)
+    {
+        if (pending == 0)
+            return NULL;
+
+        Slot& slot = slots[tail];
+        GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait ? GL_TIMEOUT_IGNORED : 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return NULL;
+
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        return &slot;
+    }
+
+    void describe(const Slot& slot, Frame& out)
+    {
+        out.width = slot.width;
+        out.height = slot.height;
+        out.nrChannels = 3;
+        out.stride = slot.stride;
+        out.timestamp = slot.timestamp;
+    }
+
+    // map the oldest (finished) slot, copy it to dst and retire the slot
+    bool copyOut(unsigned char* dst)
+    {
+        Slot& slot = slots[tail];
+        size_t bufferSize = (size_t)slot.stride * slot.height;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bufferSize, GL_MAP_READ_BIT);
+        bool ok = mapped != NULL;
+        if (ok)
+        {
+            memcpy(dst, mapped, bufferSize);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else
+        {
+            std::cout << "ERROR::PBO_READBACK::MAP_FAILED" << std::endl;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        pop();
+        return ok;
+    }
+
+    void pop()
+    {
+        tail = (tail + 1) % (int)slots.size();
+        pending--;
+    }
+};
+#endif
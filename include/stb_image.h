@@ -270,6 +270,12 @@ RECENT REVISION HISTORY:
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
 //
+// On top of SSE2, the JPEG decoder has AVX2 versions of its IDCT (two blocks
+// at a time), YCbCr conversion and 2x2 upsampling. They are compiled with a
+// per-function target attribute and picked by a CPUID test at run time, so
+// no special compiler flags are needed; define STBI_NO_AVX2 to leave them
+// out. Their output is bit-identical to the SSE2 versions.
+//
 // If for some reason you do not want to use any of SIMD code, or if
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
@@ -524,6 +530,118 @@ STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpre
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// Where a decode's memory comes from. stb_image normally calls STBI_MALLOC,
+// STBI_REALLOC and STBI_FREE; point stbi_decode_options.allocator at one of
+// these to send the allocations of a stbi_load_ex* or stbi_load_into* call
+// to your own functions instead. The image such a call returns comes from
+// the allocator too, so give it back with allocator->free rather than
+// stbi_image_free. realloc is told the old size, like STBI_REALLOC_SIZED.
+typedef struct
+{
+   void *(*alloc)  (void *user, size_t size);
+   void *(*realloc)(void *user, void *p, size_t old_size, size_t new_size);
+   void  (*free)   (void *user, void *p);
+   void  *user;
+} stbi_allocator;
+
+// A bump arena for a decode's scratch memory: Huffman and zlib tables, the
+// compressed and inflated PNG data, JPEG component planes and so on. Each
+// allocation is a pointer bump, and the arena is reset at the start of every
+// decode given it in stbi_decode_options.arena, so a batch of loads reuses
+// one block instead of fragmenting the heap. What doesn't fit goes to the
+// allocator. The returned image is never left in the arena (use
+// stbi_load_into* to avoid copying it out). stbi_arena_init with memory NULL
+// makes the arena own its block, growing it at each reset to what the
+// largest decode so far needed; free that with stbi_arena_free. An arena
+// serves one decode at a time.
+typedef struct
+{
+   unsigned char *base;
+   size_t size;   // bytes at base
+   size_t used;   // bytes handed out since the last reset
+   size_t last;   // offset of the newest block, which can grow in place
+   size_t want;   // what the largest decode would have liked to use
+   int    owned;  // base is ours to grow and free
+} stbi_arena;
+
+STBIDEF void stbi_arena_init(stbi_arena *arena, void *memory, size_t size);
+STBIDEF void stbi_arena_free(stbi_arena *arena);
+
+// filled in by a decode given it in stbi_decode_options.stats, successful or
+// not. Scratch memory the stbi_set_parallel() jobs allocate on other threads
+// isn't counted
+typedef struct
+{
+   size_t allocations;  // mallocs and reallocs
+   size_t total_bytes;  // bytes they asked for
+   size_t peak_bytes;   // most bytes in use at once
+   size_t arena_bytes;  // most of the arena in use at once
+} stbi_decode_stats;
+
+// per-call decode options: everything the setters above and the HDR/LDR
+// gamma and scale globals control, carried with the request instead, so
+// loads running concurrently on any threads each get exactly the settings
+// they asked for. stbi_decode_options_init() fills in the library defaults
+// (not the current global or per-thread settings). The result is stbi_uc*,
+// stbi_us* or float* depending on bits_per_channel; free it with
+// stbi_image_free. A NULL options pointer means the defaults.
+typedef struct
+{
+   int   flip_vertically;           // first pixel in the output is the bottom left
+   int   desired_channels;          // 0 = as stored in the file
+   int   bits_per_channel;          // 8, 16, or 32 for float (needs STBI_NO_LINEAR unset)
+   int   unpremultiply;             // see stbi_set_unpremultiply_on_load
+   int   convert_iphone_png_to_rgb; // see stbi_convert_iphone_png_to_rgb
+   float hdr_to_ldr_gamma, hdr_to_ldr_scale; // HDR files loaded at 8 or 16 bits
+   float ldr_to_hdr_gamma, ldr_to_hdr_scale; // LDR files loaded as float
+   // memory hooks, all NULL by default; they need STBI_THREAD_LOCAL and are
+   // ignored without it
+   stbi_allocator const *allocator; // NULL = STBI_MALLOC and friends
+   stbi_arena        *arena;        // scratch memory, see stbi_arena
+   stbi_decode_stats *stats;        // receives this decode's memory use
+} stbi_decode_options;
+
+STBIDEF void  stbi_decode_options_init(stbi_decode_options *options);
+STBIDEF void *stbi_load_ex_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, stbi_decode_options const *options);
+STBIDEF void *stbi_load_ex_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, stbi_decode_options const *options);
+#ifndef STBI_NO_STDIO
+STBIDEF void *stbi_load_ex               (char const *filename, int *x, int *y, int *channels_in_file, stbi_decode_options const *options);
+STBIDEF void *stbi_load_ex_from_file     (FILE *f, int *x, int *y, int *channels_in_file, stbi_decode_options const *options);
+#endif
+
+// decode into memory the caller owns (a reused staging buffer, a mapped
+// pixel-unpack buffer, ...) instead of a fresh allocation. Probe the image
+// with stbi_info*, size the buffer with stbi_decoded_size, then call one of
+// these; they return 1 and fill in x/y/channels_in_file like stbi_load_ex*,
+// or 0 (see stbi_failure_reason) if the image doesn't fit in out_size bytes.
+// Pixels are tightly packed. PNGs and JPEGs whose output needs no further
+// conversion are decoded in place; other images are decoded as usual and
+// copied in.
+STBIDEF size_t stbi_decoded_size(int x, int y, int channels_in_file, stbi_decode_options const *options);
+STBIDEF int    stbi_load_into_from_memory   (stbi_uc const *buffer, int len, void *out, size_t out_size, int *x, int *y, int *channels_in_file, stbi_decode_options const *options);
+STBIDEF int    stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, void *out, size_t out_size, int *x, int *y, int *channels_in_file, stbi_decode_options const *options);
+#ifndef STBI_NO_STDIO
+STBIDEF int    stbi_load_into               (char const *filename, void *out, size_t out_size, int *x, int *y, int *channels_in_file, stbi_decode_options const *options);
+STBIDEF int    stbi_load_into_from_file     (FILE *f, void *out, size_t out_size, int *x, int *y, int *channels_in_file, stbi_decode_options const *options);
+#endif
+
+// Large JPEGs can be decoded on several threads by calling
+//
+//    stbi_set_parallel(parallel_for, user, max_jobs);
+//
+// where parallel_for(user, job, job_context, job_count) must call
+// job(job_context, i) for every i in [0,job_count) and return once all of
+// them have finished. Baseline scans with a restart interval are then split
+// at their RST markers and entropy decoded (and IDCT'd) in runs of restart
+// intervals, and upsampling and color conversion run in row bands. Only
+// images loaded from memory can have their scans split; files and callbacks
+// still get the banded color conversion. Pass NULL to go back to
+// single-threaded decoding; set this before starting any loads.
+typedef void stbi_job_func(void *job_context, int job_index);
+typedef void stbi_parallel_func(void *user, stbi_job_func *job, void *job_context, int job_count);
+
+STBIDEF void stbi_set_parallel(stbi_parallel_func *parallel_for, void *user, int max_jobs);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -544,7 +662,10 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 ////   end header file   /////////////////////////////////////////////////////
 #endif // STBI_INCLUDE_STB_IMAGE_H
 
-#ifdef STB_IMAGE_IMPLEMENTATION
+// headers that include this one again after the implementation was
+// pulled in must only see the declarations
+#if defined(STB_IMAGE_IMPLEMENTATION) && !defined(STB_IMAGE_IMPLEMENTATION_INCLUDED)
+#define STB_IMAGE_IMPLEMENTATION_INCLUDED
 
 #if defined(STBI_ONLY_JPEG) || defined(STBI_ONLY_PNG) || defined(STBI_ONLY_BMP) \
   || defined(STBI_ONLY_TGA) || defined(STBI_ONLY_GIF) || defined(STBI_ONLY_PSD) \
@@ -643,12 +764,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -750,7 +873,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -761,7 +884,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -771,6 +894,45 @@ static int stbi__sse2_available(void)
 }
 #endif
 
+#endif
+
+// AVX2 kernels are compiled for that target on their own, next to the SSE2
+// ones, and only run if the CPU (and OS) support the instructions.
+// #define STBI_NO_AVX2 to leave them out.
+#if !defined(STBI_NO_JPEG) && !defined(STBI_NO_AVX2)
+#if defined(__GNUC__) || defined(__clang__)
+#define STBI_AVX2
+#define STBI__TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+static int stbi__avx2_detect(void)
+{
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2") != 0;
+}
+#elif defined(_MSC_VER) && _MSC_VER >= 1700
+#define STBI_AVX2
+#define STBI__TARGET_AVX2
+#include <immintrin.h>
+static int stbi__avx2_detect(void)
+{
+   int info[4];
+   __cpuid(info, 1);
+   // AVX state must be enabled by the OS (OSXSAVE + XCR0 bits 1,2)
+   if (!((info[2] >> 27) & 1) || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info, 7, 0);
+   return (info[1] >> 5) & 1;
+}
+#endif
+
+#ifdef STBI_AVX2
+static int stbi__avx2_available(void)
+{
+   static int available = -1; // benign race: every thread computes the same value
+   if (available < 0) available = stbi__avx2_detect();
+   return available;
+}
+#endif
 #endif
 #endif
 
@@ -817,6 +979,10 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   stbi_decode_options const *opt; // per-call settings, NULL = global/thread ones
+   void *out_buffer;               // caller's output memory (stbi_load_into*), or NULL
+   size_t out_buffer_size;
 } stbi__context;
 
 
@@ -828,6 +994,8 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->io.read = NULL;
    s->read_from_callbacks = 0;
    s->callback_already_read = 0;
+   s->opt = NULL;
+   s->out_buffer = NULL;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -840,6 +1008,8 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->callback_already_read = 0;
+   s->opt = NULL;
+   s->out_buffer = NULL;
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
@@ -982,9 +1152,227 @@ static int stbi__err(const char *str)
 }
 #endif
 
+#define STBI__ARENA_ALIGN 16
+
+STBIDEF void stbi_arena_init(stbi_arena *arena, void *memory, size_t size)
+{
+   size_t pad = (STBI__ARENA_ALIGN - (size_t) memory % STBI__ARENA_ALIGN) % STBI__ARENA_ALIGN;
+   memset(arena, 0, sizeof(*arena));
+   if (memory == NULL) {
+      arena->owned = 1;
+      arena->want = size;
+   } else if (size > pad) {
+      arena->base = (unsigned char *) memory + pad;
+      arena->size = size - pad;
+   }
+}
+
+STBIDEF void stbi_arena_free(stbi_arena *arena)
+{
+   if (arena->owned) STBI_FREE(arena->base);
+   arena->base = NULL;
+   arena->size = arena->used = arena->last = 0;
+}
+
+#ifdef STBI_THREAD_LOCAL
+#define STBI__ALLOC_HOOKS
+#endif
+
+#ifdef STBI__ALLOC_HOOKS
+// the memory settings of the decode running on this thread, set for the
+// length of a stbi_load_ex* or stbi_load_into* call that has any. Everything
+// allocates through stbi__malloc/stbi__realloc_sized/stbi__free, so they
+// reach the decode without being threaded through every loader
+typedef struct
+{
+   void *p;
+   size_t size;
+} stbi__alloc_block;
+
+typedef struct stbi__alloc_state
+{
+   stbi_allocator const *allocator;
+   stbi_arena *arena;
+   stbi_decode_stats *stats;
+   stbi__alloc_block *blocks; // live blocks, kept only for stats
+   int nblocks, max_blocks;
+   size_t live;
+   size_t arena_peak;         // arena bytes in use at most
+   size_t overflow;           // scratch bytes that didn't fit in the arena
+   size_t demand;             // arena size that would have fit them too
+   struct stbi__alloc_state *prev; // the state this one stands in for
+} stbi__alloc_state;
+
+static STBI_THREAD_LOCAL stbi__alloc_state *stbi__alloc;
+
+#define stbi__arena_round(n)  (((n) + STBI__ARENA_ALIGN-1) & ~(size_t) (STBI__ARENA_ALIGN-1))
+
+// after the arena's use changed: its high-water mark, and the size that
+// would have held what overflowed to the heap as well
+static void stbi__arena_moved(stbi__alloc_state *a)
+{
+   size_t used = a->arena->used;
+   if (used > a->arena_peak) a->arena_peak = used;
+   used = stbi__arena_round(used) + a->overflow;
+   if (used > a->demand) a->demand = used;
+}
+
+static void *stbi__arena_alloc(stbi__alloc_state *a, size_t size)
+{
+   stbi_arena *r = a->arena;
+   size_t start = stbi__arena_round(r->used);
+   if (start > r->size || size > r->size - start) {
+      a->overflow += stbi__arena_round(size);
+      stbi__arena_moved(a);
+      return NULL;
+   }
+   r->last = start;
+   r->used = start + size;
+   stbi__arena_moved(a);
+   return r->base + start;
+}
+
+static int stbi__arena_owns(stbi_arena *r, void *p)
+{
+   return r && (unsigned char *) p >= r->base && (unsigned char *) p < r->base + r->size;
+}
+
+static void *stbi__alloc_from(stbi__alloc_state *a, size_t size, int scratch)
+{
+   void *p = NULL;
+   if (scratch && a->arena) p = stbi__arena_alloc(a, size);
+   if (p == NULL) p = a->allocator ? a->allocator->alloc(a->allocator->user, size) : STBI_MALLOC(size);
+   return p;
+}
+
+static void stbi__free_to(stbi__alloc_state *a, void *p)
+{
+   if (stbi__arena_owns(a->arena, p)) {
+      // only the newest block can be given back
+      if ((unsigned char *) p == a->arena->base + a->arena->last)
+         a->arena->used = a->arena->last;
+   } else if (a->allocator) {
+      a->allocator->free(a->allocator->user, p);
+   } else {
+      STBI_FREE(p);
+   }
+}
+
+// stats bookkeeping: block p (NULL for a new one) is now q of size bytes
+// (q NULL once freed)
+static void stbi__alloc_note(stbi__alloc_state *a, void *p, void *q, size_t size)
+{
+   int i;
+   if (a->stats == NULL) return;
+   if (p) {
+      for (i = a->nblocks-1; i >= 0; --i) {
+         if (a->blocks[i].p == p) {
+            a->live -= a->blocks[i].size;
+            a->blocks[i] = a->blocks[--a->nblocks];
+            break;
+         }
+      }
+   }
+   if (q == NULL) return;
+   a->stats->allocations += 1;
+   a->stats->total_bytes += size;
+   if (a->nblocks == a->max_blocks) {
+      int n = a->max_blocks ? a->max_blocks * 2 : 64;
+      stbi__alloc_block *b = (stbi__alloc_block *) STBI_REALLOC_SIZED(a->blocks, sizeof(*b) * a->max_blocks, sizeof(*b) * n);
+      if (b == NULL) return; // block goes uncounted
+      a->blocks = b;
+      a->max_blocks = n;
+   }
+   a->blocks[a->nblocks].p = q;
+   a->blocks[a->nblocks].size = size;
+   ++a->nblocks;
+   a->live += size;
+   if (a->live > a->stats->peak_bytes) a->stats->peak_bytes = a->live;
+}
+#endif // STBI__ALLOC_HOOKS
+
 static void *stbi__malloc(size_t size)
 {
-    return STBI_MALLOC(size);
+#ifdef STBI__ALLOC_HOOKS
+   stbi__alloc_state *a = stbi__alloc;
+   if (a) {
+      void *p = stbi__alloc_from(a, size, 1);
+      if (p) stbi__alloc_note(a, NULL, p, size);
+      return p;
+   }
+#endif
+   return STBI_MALLOC(size);
+}
+
+#if !defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)
+// like stbi__malloc, but for memory that is likely to become the returned
+// image, so not worth putting in the arena only to be copied out again
+static void *stbi__malloc_image(size_t size)
+{
+#ifdef STBI__ALLOC_HOOKS
+   stbi__alloc_state *a = stbi__alloc;
+   if (a) {
+      void *p = stbi__alloc_from(a, size, 0);
+      if (p) stbi__alloc_note(a, NULL, p, size);
+      return p;
+   }
+#endif
+   return STBI_MALLOC(size);
+}
+#endif
+
+static void *stbi__realloc_sized(void *p, size_t old_size, size_t new_size)
+{
+#ifdef STBI__ALLOC_HOOKS
+   stbi__alloc_state *a = stbi__alloc;
+   if (a && p) {
+      void *q;
+      stbi_arena *r = a->arena;
+      if (stbi__arena_owns(r, p)) {
+         if ((unsigned char *) p == r->base + r->last && new_size <= r->size - r->last) {
+            // the newest block grows in place
+            r->used = r->last + new_size;
+            stbi__arena_moved(a);
+            q = p;
+         } else {
+            q = stbi__alloc_from(a, new_size, 1);
+            if (q == NULL) return NULL;
+            memcpy(q, p, old_size < new_size ? old_size : new_size);
+            stbi__free_to(a, p);
+         }
+      } else {
+         if (r && new_size > old_size) {
+            // as if it had grown in the arena
+            a->overflow += stbi__arena_round(new_size) - stbi__arena_round(old_size);
+            stbi__arena_moved(a);
+         }
+         if (a->allocator)
+            q = a->allocator->realloc(a->allocator->user, p, old_size, new_size);
+         else
+            q = STBI_REALLOC_SIZED(p, old_size, new_size);
+      }
+      if (q) stbi__alloc_note(a, p, q, new_size);
+      return q;
+   }
+   if (a) return stbi__malloc(new_size);
+#endif
+   STBI_NOTUSED(old_size);
+   return STBI_REALLOC_SIZED(p, old_size, new_size);
+}
+
+static void stbi__free(void *p)
+{
+#ifdef STBI__ALLOC_HOOKS
+   stbi__alloc_state *a = stbi__alloc;
+   if (a) {
+      if (p) {
+         stbi__alloc_note(a, p, NULL, 0);
+         stbi__free_to(a, p);
+      }
+      return;
+   }
+#endif
+   STBI_FREE(p);
 }
 
 // stb_image uses ints pervasively, including for offset calculations.
@@ -1058,6 +1446,26 @@ static void *stbi__malloc_mad3(int a, int b, int c, int add)
    return stbi__malloc(a*b*c + add);
 }
 
+#if !defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)
+// memory for a loader's output image: the caller's buffer (stbi_load_into*)
+// if it is big enough and the loader's output at bits_per_channel is the
+// final image, else a fresh allocation with add spare bytes. Free it with
+// stbi__free_out
+static void *stbi__malloc_out_mad3(stbi__context *s, int a, int b, int c, int add, int bits_per_channel)
+{
+   if (!stbi__mad3sizes_valid(a, b, c, add)) return NULL;
+   if (s->out_buffer && s->opt && s->opt->bits_per_channel == bits_per_channel &&
+       (size_t) a*b*c <= s->out_buffer_size)
+      return s->out_buffer;
+   return stbi__malloc_image(a*b*c + add);
+}
+
+static void stbi__free_out(stbi__context *s, void *p)
+{
+   if (p != s->out_buffer) stbi__free(p);
+}
+#endif
+
 #if !defined(STBI_NO_LINEAR) || !defined(STBI_NO_HDR) || !defined(STBI_NO_PNM)
 static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
 {
@@ -1104,11 +1512,11 @@ STBIDEF void stbi_image_free(void *retval_from_stbi_load)
 }
 
 #ifndef STBI_NO_LINEAR
-static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
+static float   *stbi__ldr_to_hdr(stbi__context *s, stbi_uc *data, int x, int y, int comp);
 #endif
 
 #ifndef STBI_NO_HDR
-static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
+static stbi_uc *stbi__hdr_to_ldr(stbi__context *s, float   *data, int x, int y, int comp);
 #endif
 
 static int stbi__vertically_flip_on_load_global = 0;
@@ -1134,6 +1542,23 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+// per-call options win over the thread and global settings
+#define stbi__flip_on_load(s)  ((s)->opt ? (s)->opt->flip_vertically : stbi__vertically_flip_on_load)
+
+static stbi_parallel_func *stbi__parallel_for = NULL;
+static void *stbi__parallel_user = NULL;
+static int stbi__parallel_jobs = 1;
+
+STBIDEF void stbi_set_parallel(stbi_parallel_func *parallel_for, void *user, int max_jobs)
+{
+   stbi__parallel_for = parallel_for;
+   stbi__parallel_user = user;
+   stbi__parallel_jobs = parallel_for && max_jobs > 1 ? max_jobs : 1;
+}
+
+// images smaller than this are not worth splitting over threads
+#define STBI__PARALLEL_MIN_PIXELS  (256*256)
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1174,7 +1599,7 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    #ifndef STBI_NO_HDR
    if (stbi__hdr_test(s)) {
       float *hdr = stbi__hdr_load(s, x,y,comp,req_comp, ri);
-      return stbi__hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
+      return stbi__hdr_to_ldr(s, hdr, *x, *y, req_comp ? req_comp : *comp);
    }
    #endif
 
@@ -1199,7 +1624,7 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return reduced;
 }
 
@@ -1215,7 +1640,7 @@ static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return enlarged;
 }
 
@@ -1275,7 +1700,7 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
 
    // @TODO: move stbi__convert_format to here
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__flip_on_load(s)) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
    }
@@ -1302,7 +1727,7 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
    // @TODO: move stbi__convert_format16 to here
    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__flip_on_load(s)) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
    }
@@ -1311,9 +1736,9 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
 }
 
 #if !defined(STBI_NO_HDR) && !defined(STBI_NO_LINEAR)
-static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, int req_comp)
+static void stbi__float_postprocess(stbi__context *s, float *result, int *x, int *y, int *comp, int req_comp)
 {
-   if (stbi__vertically_flip_on_load && result != NULL) {
+   if (stbi__flip_on_load(s) && result != NULL) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(float));
    }
@@ -1448,7 +1873,7 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
    stbi__start_mem(&s,buffer,len);
 
    result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, req_comp);
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__flip_on_load(&s)) {
       stbi__vertical_flip_slices( result, *x, *y, *z, *comp );
    }
 
@@ -1465,13 +1890,13 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
       stbi__result_info ri;
       float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
       if (hdr_data)
-         stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
+         stbi__float_postprocess(s,hdr_data,x,y,comp,req_comp);
       return hdr_data;
    }
    #endif
    data = stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
    if (data)
-      return stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp);
+      return stbi__ldr_to_hdr(s, data, *x, *y, req_comp ? req_comp : *comp);
    return stbi__errpf("unknown image type", "Image not of any known type, or corrupt");
 }
 
@@ -1510,6 +1935,215 @@ STBIDEF float *stbi_loadf_from_file(FILE *f, int *x, int *y, int *comp, int req_
 
 #endif // !STBI_NO_LINEAR
 
+STBIDEF void stbi_decode_options_init(stbi_decode_options *options)
+{
+   memset(options, 0, sizeof(*options));
+   options->bits_per_channel = 8;
+   options->hdr_to_ldr_gamma = 2.2f;
+   options->hdr_to_ldr_scale = 1.0f;
+   options->ldr_to_hdr_gamma = 2.2f;
+   options->ldr_to_hdr_scale = 1.0f;
+}
+
+#ifdef STBI__ALLOC_HOOKS
+// route the allocations of a decode with options through its allocator,
+// arena and stats, if it has any, until stbi__alloc_end
+static void stbi__alloc_begin(stbi__alloc_state *a, stbi_decode_options const *options)
+{
+   memset(a, 0, sizeof(*a));
+   if (options == NULL || (!options->allocator && !options->arena && !options->stats))
+      return;
+   a->allocator = options->allocator;
+   a->arena = options->arena;
+   a->stats = options->stats;
+   if (a->stats) memset(a->stats, 0, sizeof(*a->stats));
+   if (a->arena) {
+      stbi_arena *r = a->arena;
+      if (r->owned && r->want > r->size) {
+         STBI_FREE(r->base);
+         r->base = (unsigned char *) STBI_MALLOC(r->want);
+         r->size = r->base ? r->want : 0;
+      }
+      r->used = r->last = 0;
+   }
+   a->prev = stbi__alloc;
+   stbi__alloc = a;
+}
+
+// stop routing; an image (of size bytes) left in the arena is copied out
+static void *stbi__alloc_end(stbi__alloc_state *a, void *result, size_t size)
+{
+   if (stbi__alloc != a) return result;
+   if (result && stbi__arena_owns(a->arena, result)) {
+      void *copy = stbi__alloc_from(a, size, 0);
+      if (copy) {
+         stbi__alloc_note(a, NULL, copy, size);
+         memcpy(copy, result, size);
+      }
+      stbi__free(result);
+      result = copy ? copy : stbi__errpuc("outofmem", "Out of memory");
+   }
+   if (a->arena) {
+      if (a->demand > a->arena->want) a->arena->want = a->demand;
+      if (a->stats) a->stats->arena_bytes = a->arena_peak;
+   }
+   STBI_FREE(a->blocks);
+   stbi__alloc = a->prev;
+   return result;
+}
+#else
+typedef int stbi__alloc_state;
+#define stbi__alloc_begin(a,options)    ((void) (a))
+#define stbi__alloc_end(a,result,size)  (result)
+#endif // STBI__ALLOC_HOOKS
+
+static void *stbi__load_ex_decode(stbi__context *s, int *x, int *y, int *comp, stbi_decode_options const *options)
+{
+   stbi_decode_options defaults;
+   if (options == NULL) {
+      stbi_decode_options_init(&defaults);
+      options = &defaults;
+   }
+   if (options->desired_channels < 0 || options->desired_channels > 4)
+      return stbi__errpuc("bad req_comp", "Internal error");
+   s->opt = options;
+   switch (options->bits_per_channel) {
+      case 8:  return stbi__load_and_postprocess_8bit(s, x, y, comp, options->desired_channels);
+      case 16: return stbi__load_and_postprocess_16bit(s, x, y, comp, options->desired_channels);
+      #ifndef STBI_NO_LINEAR
+      case 32: return stbi__loadf_main(s, x, y, comp, options->desired_channels);
+      #endif
+   }
+   return stbi__errpuc("bad bits_per_channel", "Unsupported bits_per_channel in stbi_decode_options");
+}
+
+static void *stbi__load_ex_main(stbi__context *s, int *x, int *y, int *comp, stbi_decode_options const *options)
+{
+   int w, h, n;
+   void *result;
+   stbi__alloc_state a;
+   stbi__alloc_begin(&a, options);
+   result = stbi__load_ex_decode(s, &w, &h, &n, options);
+   result = stbi__alloc_end(&a, result, result ? stbi_decoded_size(w, h, n, options) : 0);
+   if (result) {
+      *x = w;
+      *y = h;
+      if (comp) *comp = n;
+   }
+   return result;
+}
+
+STBIDEF void *stbi_load_ex_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, stbi_decode_options const *options)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_ex_main(&s,x,y,channels_in_file,options);
+}
+
+STBIDEF void *stbi_load_ex_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, stbi_decode_options const *options)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_ex_main(&s,x,y,channels_in_file,options);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF void *stbi_load_ex(char const *filename, int *x, int *y, int *channels_in_file, stbi_decode_options const *options)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   void *result;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   result = stbi_load_ex_from_file(f,x,y,channels_in_file,options);
+   fclose(f);
+   return result;
+}
+
+STBIDEF void *stbi_load_ex_from_file(FILE *f, int *x, int *y, int *channels_in_file, stbi_decode_options const *options)
+{
+   void *result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   result = stbi__load_ex_main(&s,x,y,channels_in_file,options);
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+#endif // !STBI_NO_STDIO
+
+STBIDEF size_t stbi_decoded_size(int x, int y, int channels_in_file, stbi_decode_options const *options)
+{
+   int channels = options && options->desired_channels ? options->desired_channels : channels_in_file;
+   int bits = options ? options->bits_per_channel : 8;
+   return (size_t) x * y * channels * (bits / 8);
+}
+
+static int stbi__load_into_main(stbi__context *s, void *out, size_t out_size, int *x, int *y, int *comp, stbi_decode_options const *options)
+{
+   int w, h, n;
+   size_t size;
+   void *result;
+   stbi__alloc_state a;
+   s->out_buffer = out;
+   s->out_buffer_size = out_size;
+   stbi__alloc_begin(&a, options);
+   result = stbi__load_ex_decode(s, &w, &h, &n, options);
+   if (result && result != out) {
+      // decoded the usual way; the size is only known now
+      size = stbi_decoded_size(w, h, n, options);
+      if (size <= out_size)
+         memcpy(out, result, size);
+      stbi__free(result);
+      result = size <= out_size ? out : stbi__errpuc("buffer too small", "Output buffer too small for the image");
+   }
+   (void) stbi__alloc_end(&a, NULL, 0);
+   if (result == NULL) return 0;
+   *x = w;
+   *y = h;
+   if (comp) *comp = n;
+   return 1;
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, void *out, size_t out_size, int *x, int *y, int *channels_in_file, stbi_decode_options const *options)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_into_main(&s,out,out_size,x,y,channels_in_file,options);
+}
+
+STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, void *out, size_t out_size, int *x, int *y, int *channels_in_file, stbi_decode_options const *options)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_into_main(&s,out,out_size,x,y,channels_in_file,options);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into(char const *filename, void *out, size_t out_size, int *x, int *y, int *channels_in_file, stbi_decode_options const *options)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   result = stbi_load_into_from_file(f,out,out_size,x,y,channels_in_file,options);
+   fclose(f);
+   return result;
+}
+
+STBIDEF int stbi_load_into_from_file(FILE *f, void *out, size_t out_size, int *x, int *y, int *channels_in_file, stbi_decode_options const *options)
+{
+   int result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   result = stbi__load_into_main(&s,out,out_size,x,y,channels_in_file,options);
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+#endif // !STBI_NO_STDIO
+
 // these is-hdr-or-not is defined independent of whether STBI_NO_LINEAR is
 // defined, for API simplicity; if STBI_NO_LINEAR is defined, it always
 // reports false!
@@ -1762,7 +2396,7 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
 
    good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1787,12 +2421,12 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free(data); stbi__free(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1819,7 +2453,7 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
    good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1844,29 +2478,31 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free(data); stbi__free(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free(data);
    return good;
 }
 #endif
 
 #ifndef STBI_NO_LINEAR
-static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
+static float   *stbi__ldr_to_hdr(stbi__context *s, stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
    float *output;
+   float gamma = s->opt ? s->opt->ldr_to_hdr_gamma : stbi__l2h_gamma;
+   float scale = s->opt ? s->opt->ldr_to_hdr_scale : stbi__l2h_scale;
    if (!data) return NULL;
    output = (float *) stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         output[i*comp + k] = (float) (pow(data[i*comp+k]/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+         output[i*comp + k] = (float) (pow(data[i*comp+k]/255.0f, gamma) * scale);
       }
    }
    if (n < comp) {
@@ -1874,25 +2510,27 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
          output[i*comp + n] = data[i*comp + n]/255.0f;
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
 
 #ifndef STBI_NO_HDR
 #define stbi__float2int(x)   ((int) (x))
-static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
+static stbi_uc *stbi__hdr_to_ldr(stbi__context *s, float   *data, int x, int y, int comp)
 {
    int i,k,n;
    stbi_uc *output;
+   float gamma_i = s->opt ? 1/s->opt->hdr_to_ldr_gamma : stbi__h2l_gamma_i;
+   float scale_i = s->opt ? 1/s->opt->hdr_to_ldr_scale : stbi__h2l_scale_i;
    if (!data) return NULL;
    output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         float z = (float) pow(data[i*comp+k]*stbi__h2l_scale_i, stbi__h2l_gamma_i) * 255 + 0.5f;
+         float z = (float) pow(data[i*comp+k]*scale_i, gamma_i) * 255 + 0.5f;
          if (z < 0) z = 0;
          if (z > 255) z = 255;
          output[i*comp + k] = (stbi_uc) stbi__float2int(z);
@@ -1904,7 +2542,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (stbi_uc) stbi__float2int(z);
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -1946,6 +2584,19 @@ typedef struct
    int    delta[17];   // old 'firstsymbol' - old 'firstcode'
 } stbi__huffman;
 
+typedef stbi_uc *(*resample_row_func)(stbi_uc *out, stbi_uc *in0, stbi_uc *in1,
+                                    int w, int hs);
+
+typedef struct
+{
+   resample_row_func resample;
+   stbi_uc *line0,*line1;
+   int hs,vs;   // expansion factor in each axis
+   int w_lores; // horizontal pixels pre-expansion
+   int ystep;   // how far through vertical expansion we are
+   int ypos;    // which pre-expansion row we're on
+} stbi__resample;
+
 typedef struct
 {
    stbi__context *s;
@@ -1994,8 +2645,20 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+// output, set up by stbi__jpeg_start_output: before decoding a scan that
+// can be "fused", i.e. converted MCU row by MCU row while the component
+// rows are still in cache, otherwise once all scans are decoded
+   int req_comp;
+   stbi_uc *output;
+   int out_n, decode_n, is_rgb;
+   stbi__resample res_comp[4];
+   int fused;     // the scan being decoded converts rows as it goes
+   int rows_done; // output rows converted so far
+   stbi_uc *last_row; // scratch for the last row when output is the caller's buffer
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+   void (*idct_block2_kernel)(stbi_uc *out0, int out_stride0, short data0[64], stbi_uc *out1, int out_stride1, short data1[64]); // NULL if none
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
@@ -2704,42 +3367,220 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
-#ifdef STBI_NEON
-
-// NEON integer IDCT. should produce bit-identical
-// results to the generic C version.
-static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
+#ifdef STBI_AVX2
+// avx2 integer IDCT of two blocks at once: the sse2 IDCT above, step for
+// step, with block 0 in the low 128-bit lane and block 1 in the high one.
+// Every instruction used works within lanes, so both blocks come out
+// bit-identical to stbi__idct_block.
+STBI__TARGET_AVX2 static void stbi__idct2_avx2(stbi_uc *out0, int out_stride0, short data0[64],
+                                               stbi_uc *out1, int out_stride1, short data1[64])
 {
-   int16x8_t row0, row1, row2, row3, row4, row5, row6, row7;
+   __m256i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m256i tmp;
 
-   int16x4_t rot0_0 = vdup_n_s16(stbi__f2f(0.5411961f));
-   int16x4_t rot0_1 = vdup_n_s16(stbi__f2f(-1.847759065f));
-   int16x4_t rot0_2 = vdup_n_s16(stbi__f2f( 0.765366865f));
-   int16x4_t rot1_0 = vdup_n_s16(stbi__f2f( 1.175875602f));
-   int16x4_t rot1_1 = vdup_n_s16(stbi__f2f(-0.899976223f));
-   int16x4_t rot1_2 = vdup_n_s16(stbi__f2f(-2.562915447f));
-   int16x4_t rot2_0 = vdup_n_s16(stbi__f2f(-1.961570560f));
-   int16x4_t rot2_1 = vdup_n_s16(stbi__f2f(-0.390180644f));
-   int16x4_t rot3_0 = vdup_n_s16(stbi__f2f( 0.298631336f));
-   int16x4_t rot3_1 = vdup_n_s16(stbi__f2f( 2.053119869f));
-   int16x4_t rot3_2 = vdup_n_s16(stbi__f2f( 3.072711026f));
-   int16x4_t rot3_3 = vdup_n_s16(stbi__f2f( 1.501321110f));
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
 
-#define dct_long_mul(out, inq, coeff) \
-   int32x4_t out##_l = vmull_s16(vget_low_s16(inq), coeff); \
-   int32x4_t out##_h = vmull_s16(vget_high_s16(inq), coeff)
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
 
-#define dct_long_mac(out, acc, inq, coeff) \
-   int32x4_t out##_l = vmlal_s16(acc##_l, vget_low_s16(inq), coeff); \
-   int32x4_t out##_h = vmlal_s16(acc##_h, vget_high_s16(inq), coeff)
+   #define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
 
-#define dct_widen(out, inq) \
-   int32x4_t out##_l = vshll_n_s16(vget_low_s16(inq), 12); \
-   int32x4_t out##_h = vshll_n_s16(vget_high_s16(inq), 12)
+   #define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
 
-// wide add
-#define dct_wadd(out, a, b) \
-   int32x4_t out##_l = vaddq_s32(a##_l, b##_l); \
+   #define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   // two 8-coefficient rows, one per block
+   #define dct_load(k) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i *) (data0 + (k)*8))), \
+                              _mm_load_si128((const __m128i *) (data1 + (k)*8)), 1)
+
+   // two 8-pixel rows: the low 8 bytes of each lane of v (or its upper 8
+   // bytes with hi set)
+   #define dct_store(v, hi) \
+      { \
+         __m256i v_ = (hi) ? _mm256_shuffle_epi32((v), 0x4e) : (v); \
+         _mm_storel_epi64((__m128i *) out0, _mm256_castsi256_si128(v_)); out0 += out_stride0; \
+         _mm_storel_epi64((__m128i *) out1, _mm256_extracti128_si256(v_, 1)); out1 += out_stride1; \
+      }
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   row0 = dct_load(0);
+   row1 = dct_load(1);
+   row2 = dct_load(2);
+   row3 = dct_load(3);
+   row4 = dct_load(4);
+   row5 = dct_load(5);
+   row6 = dct_load(6);
+   row7 = dct_load(7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   // 16bit 8x8 transposes, one per lane
+   dct_interleave16(row0, row4);
+   dct_interleave16(row1, row5);
+   dct_interleave16(row2, row6);
+   dct_interleave16(row3, row7);
+
+   dct_interleave16(row0, row2);
+   dct_interleave16(row1, row3);
+   dct_interleave16(row4, row6);
+   dct_interleave16(row5, row7);
+
+   dct_interleave16(row0, row1);
+   dct_interleave16(row2, row3);
+   dct_interleave16(row4, row5);
+   dct_interleave16(row6, row7);
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      __m256i p0 = _mm256_packus_epi16(row0, row1);
+      __m256i p1 = _mm256_packus_epi16(row2, row3);
+      __m256i p2 = _mm256_packus_epi16(row4, row5);
+      __m256i p3 = _mm256_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transposes
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      dct_interleave8(p0, p1);
+      dct_interleave8(p2, p3);
+
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      dct_store(p0, 0);
+      dct_store(p0, 1);
+      dct_store(p2, 0);
+      dct_store(p2, 1);
+      dct_store(p1, 0);
+      dct_store(p1, 1);
+      dct_store(p3, 0);
+      dct_store(p3, 1);
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_load
+#undef dct_store
+}
+#endif // STBI_AVX2
+
+#ifdef STBI_NEON
+
+// NEON integer IDCT. should produce bit-identical
+// results to the generic C version.
+static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
+{
+   int16x8_t row0, row1, row2, row3, row4, row5, row6, row7;
+
+   int16x4_t rot0_0 = vdup_n_s16(stbi__f2f(0.5411961f));
+   int16x4_t rot0_1 = vdup_n_s16(stbi__f2f(-1.847759065f));
+   int16x4_t rot0_2 = vdup_n_s16(stbi__f2f( 0.765366865f));
+   int16x4_t rot1_0 = vdup_n_s16(stbi__f2f( 1.175875602f));
+   int16x4_t rot1_1 = vdup_n_s16(stbi__f2f(-0.899976223f));
+   int16x4_t rot1_2 = vdup_n_s16(stbi__f2f(-2.562915447f));
+   int16x4_t rot2_0 = vdup_n_s16(stbi__f2f(-1.961570560f));
+   int16x4_t rot2_1 = vdup_n_s16(stbi__f2f(-0.390180644f));
+   int16x4_t rot3_0 = vdup_n_s16(stbi__f2f( 0.298631336f));
+   int16x4_t rot3_1 = vdup_n_s16(stbi__f2f( 2.053119869f));
+   int16x4_t rot3_2 = vdup_n_s16(stbi__f2f( 3.072711026f));
+   int16x4_t rot3_3 = vdup_n_s16(stbi__f2f( 1.501321110f));
+
+#define dct_long_mul(out, inq, coeff) \
+   int32x4_t out##_l = vmull_s16(vget_low_s16(inq), coeff); \
+   int32x4_t out##_h = vmull_s16(vget_high_s16(inq), coeff)
+
+#define dct_long_mac(out, acc, inq, coeff) \
+   int32x4_t out##_l = vmlal_s16(acc##_l, vget_low_s16(inq), coeff); \
+   int32x4_t out##_h = vmlal_s16(acc##_h, vget_high_s16(inq), coeff)
+
+#define dct_widen(out, inq) \
+   int32x4_t out##_l = vshll_n_s16(vget_low_s16(inq), 12); \
+   int32x4_t out##_h = vshll_n_s16(vget_high_s16(inq), 12)
+
+// wide add
+#define dct_wadd(out, a, b) \
+   int32x4_t out##_l = vaddq_s32(a##_l, b##_l); \
    int32x4_t out##_h = vaddq_s32(a##_h, b##_h)
 
 // wide sub
@@ -2946,13 +3787,55 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// fused decode and color conversion, see stbi__jpeg_start_output
+static int stbi__jpeg_can_fuse(stbi__jpeg *z);
+static int stbi__jpeg_start_output(stbi__jpeg *z);
+static void stbi__jpeg_convert_ready(stbi__jpeg *z, int mcu_rows);
+
+// with a two-block IDCT kernel, decoded blocks are held back one at a time
+// so they can go through it in pairs. Coefficients are decoded into
+// stbi__idct_queue_buf(); call stbi__idct_queue_flush() before the output
+// of the last block pushed is needed
+typedef struct
+{
+   STBI_SIMD_ALIGN(short, buf[2][64]);
+   short *data;
+   stbi_uc *out;
+   int out_stride;
+   int pending;
+} stbi__idct_queue;
+
+#define stbi__idct_queue_buf(q)  ((q)->buf[(q)->pending])
+
+static void stbi__idct_queue_push(stbi__jpeg *z, stbi__idct_queue *q, stbi_uc *out, int out_stride, short *data)
+{
+   if (!z->idct_block2_kernel) {
+      z->idct_block_kernel(out, out_stride, data);
+   } else if (!q->pending) {
+      q->data = data;
+      q->out = out;
+      q->out_stride = out_stride;
+      q->pending = 1;
+   } else {
+      z->idct_block2_kernel(q->out, q->out_stride, q->data, out, out_stride, data);
+      q->pending = 0;
+   }
+}
+
+static void stbi__idct_queue_flush(stbi__jpeg *z, stbi__idct_queue *q)
+{
+   if (q->pending)
+      z->idct_block_kernel(q->out, q->out_stride, q->data);
+   q->pending = 0;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
    if (!z->progressive) {
       if (z->scan_n == 1) {
          int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
+         stbi__idct_queue q;
          int n = z->order[0];
          // non-interleaved data, we just need to process one block at a time,
          // in trivial scanline order
@@ -2960,25 +3843,29 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          // component has, independent of interleaved MCU blocking and such
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
+         q.pending = 0;
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
+               short *data = stbi__idct_queue_buf(&q);
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__idct_queue_push(z, &q, z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
                   // if it's NOT a restart, then just bail, so we get corrupt data
                   // rather than no data
-                  if (!STBI__RESTART(z->marker)) return 1;
+                  if (!STBI__RESTART(z->marker)) { stbi__idct_queue_flush(z, &q); return 1; }
                   stbi__jpeg_reset(z);
                }
             }
          }
+         stbi__idct_queue_flush(z, &q);
          return 1;
       } else { // interleaved
          int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
+         stbi__idct_queue q;
+         q.pending = 0;
          for (j=0; j < z->img_mcu_y; ++j) {
             for (i=0; i < z->img_mcu_x; ++i) {
                // scan an interleaved mcu... process scan_n components in order
@@ -2991,8 +3878,9 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                         int x2 = (i*z->img_comp[n].h + x)*8;
                         int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
+                        short *data = stbi__idct_queue_buf(&q);
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__idct_queue_push(z, &q, z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
                      }
                   }
                }
@@ -3000,11 +3888,17 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                // so now count down the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  if (!STBI__RESTART(z->marker)) return 1;
+                  if (!STBI__RESTART(z->marker)) { stbi__idct_queue_flush(z, &q); return 1; }
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->fused) {
+               // this MCU row is complete: convert the output rows it unblocks
+               stbi__idct_queue_flush(z, &q);
+               stbi__jpeg_convert_ready(z, j+1);
+            }
          }
+         stbi__idct_queue_flush(z, &q);
          return 1;
       }
    } else {
@@ -3082,6 +3976,8 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
    if (z->progressive) {
       // dequantize and idct the data
       int i,j,n;
+      stbi__idct_queue q;
+      q.pending = 0;
       for (n=0; n < z->s->img_n; ++n) {
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
@@ -3089,10 +3985,11 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__idct_queue_push(z, &q, z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
             }
          }
       }
+      stbi__idct_queue_flush(z, &q);
    }
 }
 
@@ -3244,17 +4141,17 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
    int i;
    for (i=0; i < ncomp; ++i) {
       if (z->img_comp[i].raw_data) {
-         STBI_FREE(z->img_comp[i].raw_data);
+         stbi__free(z->img_comp[i].raw_data);
          z->img_comp[i].raw_data = NULL;
          z->img_comp[i].data = NULL;
       }
       if (z->img_comp[i].raw_coeff) {
-         STBI_FREE(z->img_comp[i].raw_coeff);
+         stbi__free(z->img_comp[i].raw_coeff);
          z->img_comp[i].raw_coeff = 0;
          z->img_comp[i].coeff = 0;
       }
       if (z->img_comp[i].linebuf) {
-         STBI_FREE(z->img_comp[i].linebuf);
+         stbi__free(z->img_comp[i].linebuf);
          z->img_comp[i].linebuf = NULL;
       }
    }
@@ -3408,6 +4305,165 @@ static stbi_uc stbi__skip_jpeg_junk_at_end(stbi__jpeg *j)
    return STBI__MARKER_none;
 }
 
+// decode count MCUs of a baseline scan, starting at MCU index first, with no
+// restart handling; the parallel path calls this once per restart interval
+static int stbi__jpeg_decode_mcus(stbi__jpeg *z, int first, int count)
+{
+   int m,k,x,y;
+   stbi__idct_queue q;
+   q.pending = 0;
+   if (z->scan_n == 1) {
+      // non-interleaved: every data block is an MCU
+      int n = z->order[0];
+      int w = (z->img_comp[n].x+7) >> 3;
+      int ha = z->img_comp[n].ha;
+      for (m=first; m < first+count; ++m) {
+         int i = m % w, j = m / w;
+         short *data = stbi__idct_queue_buf(&q);
+         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+         stbi__idct_queue_push(z, &q, z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+      }
+   } else {
+      for (m=first; m < first+count; ++m) {
+         int i = m % z->img_mcu_x, j = m / z->img_mcu_x;
+         for (k=0; k < z->scan_n; ++k) {
+            int n = z->order[k];
+            int ha = z->img_comp[n].ha;
+            for (y=0; y < z->img_comp[n].v; ++y) {
+               for (x=0; x < z->img_comp[n].h; ++x) {
+                  int x2 = (i*z->img_comp[n].h + x)*8;
+                  int y2 = (j*z->img_comp[n].v + y)*8;
+                  short *data = stbi__idct_queue_buf(&q);
+                  if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  stbi__idct_queue_push(z, &q, z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+               }
+            }
+         }
+      }
+   }
+   stbi__idct_queue_flush(z, &q);
+   return 1;
+}
+
+// find where each restart interval's entropy-coded data starts, beginning
+// at p; returns the number of intervals (0 if the scan is not terminated by
+// a marker or has more than max_intervals) and leaves *scan_end on the 0xff
+// of the marker that ends the scan
+static int stbi__jpeg_find_restarts(stbi_uc *p, stbi_uc *end, stbi_uc **interval, int max_intervals, stbi_uc **scan_end)
+{
+   int n = 0;
+   interval[n++] = p;
+   for (;;) {
+      p = (stbi_uc *) memchr(p, 0xff, end - p);
+      if (p == NULL) return 0;
+      while (p+1 < end && p[1] == 0xff) ++p; // fill bytes
+      if (p+1 >= end) return 0;
+      if (p[1] == 0x00) { // stuffed zero
+         p += 2;
+         continue;
+      }
+      if (!STBI__RESTART(p[1])) {
+         *scan_end = p;
+         return n;
+      }
+      if (n == max_intervals) return 0;
+      p += 2;
+      interval[n++] = p;
+   }
+}
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **interval;    // start of each restart interval
+   int nintervals;
+   int per_job;           // restart intervals per job
+   int mcus;              // MCUs in the scan
+   stbi_uc *job_failed;
+} stbi__jpeg_scan_jobs;
+
+static void stbi__jpeg_scan_job(void *context, int job)
+{
+   stbi__jpeg_scan_jobs *p = (stbi__jpeg_scan_jobs *) context;
+   int ri = p->z->restart_interval;
+   int i = job * p->per_job;
+   int end = i + p->per_job < p->nintervals ? i + p->per_job : p->nintervals;
+   stbi__context s;
+   // each job has its own bit reader and DC predictors over the shared
+   // tables and component buffers; the jobs write disjoint blocks
+   stbi__jpeg *local = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!local) { p->job_failed[job] = 1; return; }
+   memcpy(local, p->z, sizeof(stbi__jpeg));
+   s = *p->z->s;
+   local->s = &s;
+   for (; i < end; ++i) {
+      int first = i * ri;
+      int count = p->mcus - first < ri ? p->mcus - first : ri;
+      s.img_buffer = p->interval[i];
+      stbi__jpeg_reset(local);
+      if (!stbi__jpeg_decode_mcus(local, first, count)) {
+         p->job_failed[job] = 1;
+         break;
+      }
+   }
+   stbi__free(local);
+}
+
+// decode a baseline scan on the stbi_set_parallel() callback by splitting it
+// at its RST markers. Returns 0 without consuming anything when the scan
+// cannot be split (or a job hit an error), so the caller can fall back to
+// stbi__parse_entropy_coded_data, which also reports any error properly.
+static int stbi__jpeg_parse_scan_parallel(stbi__jpeg *z)
+{
+   stbi__jpeg_scan_jobs p;
+   stbi_uc *scan_end = NULL;
+   int expected, njobs, i, ok = 1;
+
+   if (stbi__parallel_jobs < 2 || z->progressive || !z->restart_interval || z->s->read_from_callbacks)
+      return 0;
+   if ((stbi__uint32) z->s->img_x * z->s->img_y < STBI__PARALLEL_MIN_PIXELS)
+      return 0;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      p.mcus = ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3);
+   } else {
+      p.mcus = z->img_mcu_x * z->img_mcu_y;
+   }
+   expected = (p.mcus + z->restart_interval - 1) / z->restart_interval;
+   if (expected < 2) return 0;
+
+   p.interval = (stbi_uc **) stbi__malloc_mad2(expected, sizeof(stbi_uc *), 0);
+   if (!p.interval) return 0;
+   p.nintervals = stbi__jpeg_find_restarts(z->s->img_buffer, z->s->img_buffer_end, p.interval, expected, &scan_end);
+   if (p.nintervals != expected) {
+      // truncated or padded stream: the serial decoder knows how to cope
+      stbi__free(p.interval);
+      return 0;
+   }
+
+   // several jobs per thread so uneven intervals still balance
+   njobs = stbi__parallel_jobs * 4 < expected ? stbi__parallel_jobs * 4 : expected;
+   p.per_job = (expected + njobs - 1) / njobs;
+   njobs = (expected + p.per_job - 1) / p.per_job;
+   p.z = z;
+   p.job_failed = (stbi_uc *) stbi__malloc(njobs);
+   if (!p.job_failed) { stbi__free(p.interval); return 0; }
+   memset(p.job_failed, 0, njobs);
+
+   stbi__parallel_for(stbi__parallel_user, stbi__jpeg_scan_job, &p, njobs);
+
+   for (i=0; i < njobs; ++i)
+      if (p.job_failed[i]) ok = 0;
+   stbi__free(p.job_failed);
+   stbi__free(p.interval);
+   if (!ok) return 0;
+
+   // leave the stream where the serial decoder would: at the next marker
+   z->s->img_buffer = scan_end;
+   z->marker = STBI__MARKER_none;
+   return 1;
+}
+
 // decode image to YCbCr format
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
@@ -3422,7 +4478,15 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
    while (!stbi__EOI(m)) {
       if (stbi__SOS(m)) {
          if (!stbi__process_scan_header(j)) return 0;
-         if (!stbi__parse_entropy_coded_data(j)) return 0;
+         if (j->output) {
+            j->rows_done = 0; // another scan may change rows already converted
+         } else if (stbi__jpeg_can_fuse(j)) {
+            if (!stbi__jpeg_start_output(j)) return 0;
+            j->fused = 1;
+         }
+         if (!stbi__jpeg_parse_scan_parallel(j))
+            if (!stbi__parse_entropy_coded_data(j)) return 0;
+         j->fused = 0;
          if (j->marker == STBI__MARKER_none ) {
          j->marker = stbi__skip_jpeg_junk_at_end(j);
             // if we reach eof without hitting a marker, stbi__get_marker() below will fail and we'll eventually return 0
@@ -3448,9 +4512,6 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
 
 // static jfif-centered resampling (across block boundaries)
 
-typedef stbi_uc *(*resample_row_func)(stbi_uc *out, stbi_uc *in0, stbi_uc *in1,
-                                    int w, int hs);
-
 #define stbi__div4(x) ((stbi_uc) ((x) >> 2))
 
 static stbi_uc *resample_row_1(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
@@ -3817,10 +4878,180 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// 16 pixels per step, bit-identical to stbi__resample_row_hv_2_simd (and
+// so to the scalar version); "prev" and "next" are built across the two
+// 128-bit lanes with a lane permute plus alignr
+STBI__TARGET_AVX2 static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass, 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i curr  = _mm256_add_epi16(_mm256_slli_epi16(nearw, 2), _mm256_sub_epi16(farw, nearw));
+
+      // curr shifted by one pixel either way; alignr works per lane, so
+      // pair each lane with its neighbour first
+      __m256i prv0 = _mm256_alignr_epi8(curr, _mm256_permute2x128_si256(curr, curr, 0x08), 14);
+      __m256i nxt0 = _mm256_alignr_epi8(_mm256_permute2x128_si256(curr, curr, 0x81), curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, (short) t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, (short) (3*in_near[i+16] + in_far[i+16]), 15);
+
+      // horizontal pass, as in the sse2 version
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curb = _mm256_add_epi16(_mm256_slli_epi16(curr, 2), bias);
+      __m256i even = _mm256_add_epi16(_mm256_sub_epi16(prev, curr), curb);
+      __m256i odd  = _mm256_add_epi16(_mm256_sub_epi16(next, curr), curb);
+
+      // the per-lane unpack and pack cancel out: outv is in pixel order
+      __m256i de0  = _mm256_srli_epi16(_mm256_unpacklo_epi16(even, odd), 4);
+      __m256i de1  = _mm256_srli_epi16(_mm256_unpackhi_epi16(even, odd), 4);
+      __m256i outv = _mm256_packus_epi16(de0, de1);
+      _mm256_storeu_si256((__m256i *) (out + i*2), outv);
+
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+
+// 16 pixels per step. step == 4 uses the 16-bit arithmetic of
+// stbi__YCbCr_to_RGB_simd; step == 3, which that one leaves to the scalar
+// loop, uses the scalar loop's 32-bit fixed point so it still matches it
+// exactly. Whatever is left goes through stbi__YCbCr_to_RGB_simd.
+STBI__TARGET_AVX2 static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 4) {
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i bias128 = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // widen; these equal the sse2 version's byte unpacks
+         // ((y << 8) + 128) >> 4 and (c - 128) << 8
+         __m256i yw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y+i)));
+         __m256i crb = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcr+i)));
+         __m256i cbb = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcb+i)));
+         __m256i yws = _mm256_add_epi16(_mm256_slli_epi16(yw, 4), _mm256_set1_epi16(8));
+         __m256i crw = _mm256_slli_epi16(_mm256_sub_epi16(crb, bias128), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_sub_epi16(cbb, bias128), 8);
+
+         // color transform
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rw  = _mm256_srai_epi16(_mm256_add_epi16(cr0, yws), 4);
+         __m256i bw  = _mm256_srai_epi16(_mm256_add_epi16(yws, cb1), 4);
+         __m256i gw  = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(cb0, yws), cr1), 4);
+
+         // interleave within lanes: pixels 0-3, 8-11 in o0 and 4-7, 12-15 in o1
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+         _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+         out += 64;
+      }
+   } else if (step == 3) {
+      __m256i y_round = _mm256_set1_epi32(1<<19);
+      __m256i c128  = _mm256_set1_epi32(128);
+      __m256i r_cr  = _mm256_set1_epi32( stbi__float2fixed(1.40200f));
+      __m256i g_cr  = _mm256_set1_epi32(-stbi__float2fixed(0.71414f));
+      __m256i g_cb  = _mm256_set1_epi32(-stbi__float2fixed(0.34414f));
+      __m256i b_cb  = _mm256_set1_epi32( stbi__float2fixed(1.77200f));
+      __m256i g_mask = _mm256_set1_epi32((int) 0xffff0000);
+      __m256i xw = _mm256_set1_epi16(255);
+      // rgba -> rgb within each lane; the last 4 bytes are don't-care
+      __m256i pack3 = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                       0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+
+      // each step stores 4 bytes past its 16 pixels, so keep one pixel back
+      // for the tail to write over them (at most the final pixel's spare
+      // alpha byte, which the scalar loop writes too, lands past the row)
+      for (; i+16 < count; i += 16) {
+         __m256i rgbw[3];
+         int h,c;
+         for (h=0; h < 2; ++h) {
+            __m256i yf = _mm256_add_epi32(_mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (y+i+h*8))), 20), y_round);
+            __m256i cr = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (pcr+i+h*8))), c128);
+            __m256i cb = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (pcb+i+h*8))), c128);
+            __m256i r = _mm256_add_epi32(yf, _mm256_mullo_epi32(cr, r_cr));
+            __m256i g = _mm256_add_epi32(_mm256_add_epi32(yf, _mm256_mullo_epi32(cr, g_cr)),
+                                         _mm256_and_si256(_mm256_mullo_epi32(cb, g_cb), g_mask));
+            __m256i b = _mm256_add_epi32(yf, _mm256_mullo_epi32(cb, b_cb));
+            __m256i v[3];
+            v[0] = _mm256_srai_epi32(r, 20);
+            v[1] = _mm256_srai_epi32(g, 20);
+            v[2] = _mm256_srai_epi32(b, 20);
+            for (c=0; c < 3; ++c) {
+               if (h == 0) {
+                  rgbw[c] = v[c];
+               } else {
+                  // packs interleaves the halves by lane; put pixels back in order
+                  rgbw[c] = _mm256_permute4x64_epi64(_mm256_packs_epi32(rgbw[c], v[c]), 0xd8);
+               }
+            }
+         }
+         {
+            // packus clamps to 0..255 just like the scalar loop
+            __m256i brb = _mm256_packus_epi16(rgbw[0], rgbw[2]);
+            __m256i gxb = _mm256_packus_epi16(rgbw[1], xw);
+            __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+            __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+            __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+            __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+            __m256i c0 = _mm256_shuffle_epi8(_mm256_permute2x128_si256(o0, o1, 0x20), pack3); // pixels 0-3, 4-7
+            __m256i c1 = _mm256_shuffle_epi8(_mm256_permute2x128_si256(o0, o1, 0x31), pack3); // pixels 8-11, 12-15
+            _mm_storeu_si128((__m128i *) (out +  0), _mm256_castsi256_si128(c0));
+            _mm_storeu_si128((__m128i *) (out + 12), _mm256_extracti128_si256(c0, 1));
+            _mm_storeu_si128((__m128i *) (out + 24), _mm256_castsi256_si128(c1));
+            _mm_storeu_si128((__m128i *) (out + 36), _mm256_extracti128_si256(c1, 1));
+         }
+         out += 48;
+      }
+   }
+
+   stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
    j->idct_block_kernel = stbi__idct_block;
+   j->idct_block2_kernel = NULL;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
@@ -3832,6 +5063,14 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__avx2_available()) {
+      j->idct_block2_kernel = stbi__idct2_avx2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
    j->idct_block_kernel = stbi__idct_simd;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
@@ -3843,18 +5082,10 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
 static void stbi__cleanup_jpeg(stbi__jpeg *j)
 {
    stbi__free_jpeg_components(j, j->s->img_n, 0);
+   stbi__free(j->last_row);
+   j->last_row = NULL;
 }
 
-typedef struct
-{
-   resample_row_func resample;
-   stbi_uc *line0,*line1;
-   int hs,vs;   // expansion factor in each axis
-   int w_lores; // horizontal pixels pre-expansion
-   int ystep;   // how far through vertical expansion we are
-   int ypos;    // which pre-expansion row we're on
-} stbi__resample;
-
 // fast 0..255 * 0..255 => 0..255 rounded multiplication
 static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
 {
@@ -3862,169 +5093,332 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// position a resampler set up for output row 0 at output row y
+static void stbi__resample_seek(stbi__resample *r, stbi__resample const *start, int w2, int comp_y, int y)
 {
-   int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
-
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
-
-   // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
-
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
-
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
-   else
-      decode_n = z->s->img_n;
-
-   // nothing to do if no components requested; check this now to avoid
-   // accessing uninitialized coutput[0] later
-   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+   int wraps = ((start->vs >> 1) + y) / start->vs; // input rows stepped past
+   *r = *start;
+   r->ystep = ((start->vs >> 1) + y) % start->vs;
+   r->ypos  = wraps;
+   r->line1 = start->line0 + w2 * (wraps < comp_y ? wraps : comp_y-1);
+   if (wraps > 0)
+      r->line0 = start->line0 + w2 * (wraps-1 < comp_y ? wraps-1 : comp_y-1);
+}
 
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+// upsample and color convert output rows [y0,y1); res_start holds the
+// resamplers as set up for row 0, and linebuf has one img_x+3 byte line per
+// component that only this caller writes to. The 1- and 3-channel writers
+// may store a throwaway alpha byte one past each row; if scratch (n*img_x+1
+// bytes) is given, row y1-1 is built there so that byte can't land in the
+// next band
+static void stbi__jpeg_convert_rows(stbi__jpeg *z, stbi__resample const *res_start, stbi_uc **linebuf, stbi_uc *scratch, stbi_uc *output, int n, int decode_n, int is_rgb, int y0, int y1)
+{
+   int k;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   stbi__resample res_comp[4];
 
-      stbi__resample res_comp[4];
+   for (k=0; k < decode_n; ++k)
+      stbi__resample_seek(&res_comp[k], &res_start[k], z->img_comp[k].w2, z->img_comp[k].y, y0);
 
+   for (j=y0; j < (unsigned int) y1; ++j) {
+      stbi_uc *row = output + n * z->s->img_x * j;
+      stbi_uc *out = scratch && j+1 == (unsigned int) y1 ? scratch : row;
+      stbi_uc *dst = out;
       for (k=0; k < decode_n; ++k) {
          stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
-      }
-
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
                for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
                   out += n;
                }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
                for (i=0; i < z->s->img_x; ++i) {
                   stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
                   out += n;
                }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
                for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
                   out += n;
                }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
             }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
          }
       }
-      stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-      return output;
+      if (dst != row)
+         memcpy(row, dst, (size_t) n * z->s->img_x);
    }
 }
 
+// how many row bands the color conversion splits into; below 2 it runs
+// serially
+static int stbi__jpeg_convert_bands(stbi__jpeg *z)
+{
+   int nbands = stbi__parallel_jobs;
+   if (nbands < 2 || (stbi__uint32) z->s->img_x * z->s->img_y < STBI__PARALLEL_MIN_PIXELS)
+      return 0;
+   if (nbands > (int) z->s->img_y / 16) nbands = z->s->img_y / 16; // bands of at least 16 rows
+   return nbands;
+}
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi__resample const *res_start;
+   stbi_uc *linebufs; // decode_n lines of img_x+3 bytes per band, then the scratch row
+   size_t band_bytes;
+   stbi_uc *output;
+   int n, decode_n, is_rgb;
+   int rows_per_band;
+} stbi__jpeg_convert_jobs;
+
+static void stbi__jpeg_convert_job(void *context, int band)
+{
+   stbi__jpeg_convert_jobs *p = (stbi__jpeg_convert_jobs *) context;
+   int img_y = (int) p->z->s->img_y;
+   int y0 = band * p->rows_per_band;
+   int y1 = y0 + p->rows_per_band < img_y ? y0 + p->rows_per_band : img_y;
+   stbi_uc *base = p->linebufs + p->band_bytes * band;
+   stbi_uc *linebuf[4];
+   int k;
+   for (k=0; k < p->decode_n; ++k)
+      linebuf[k] = base + (size_t) k * (p->z->s->img_x + 3);
+   stbi__jpeg_convert_rows(p->z, p->res_start, linebuf, p->n == 1 || p->n == 3 ? base + (size_t) p->decode_n * (p->z->s->img_x + 3) : NULL,
+                           p->output, p->n, p->decode_n, p->is_rgb, y0, y1);
+}
+
+// upsample and color convert in row bands on the stbi_set_parallel()
+// callback; returns 0 (having done nothing) if the image is too small to
+// split or the band line buffers can't be allocated
+static int stbi__jpeg_convert_parallel(stbi__jpeg *z, stbi__resample const *res_start, stbi_uc *output, int n, int decode_n, int is_rgb)
+{
+   stbi__jpeg_convert_jobs p;
+   int img_y = (int) z->s->img_y;
+   int nbands = stbi__jpeg_convert_bands(z);
+
+   if (nbands < 2) return 0;
+   p.rows_per_band = (img_y + nbands - 1) / nbands;
+   nbands = (img_y + p.rows_per_band - 1) / p.rows_per_band;
+
+   if (!stbi__mad3sizes_valid(decode_n + n, z->s->img_x + 3, nbands, 0)) return 0;
+   p.band_bytes = (size_t) (decode_n + n) * (z->s->img_x + 3);
+   p.linebufs = (stbi_uc *) stbi__malloc(p.band_bytes * nbands);
+   if (!p.linebufs) return 0;
+   p.z = z;
+   p.res_start = res_start;
+   p.output = output;
+   p.n = n;
+   p.decode_n = decode_n;
+   p.is_rgb = is_rgb;
+   stbi__parallel_for(stbi__parallel_user, stbi__jpeg_convert_job, &p, nbands);
+   stbi__free(p.linebufs);
+   return 1;
+}
+
+// number of output channels, how many components feed them, and whether
+// those are RGB rather than YCbCr
+static void stbi__jpeg_output_format(stbi__jpeg *z, int *n, int *decode_n, int *is_rgb)
+{
+   *n = z->req_comp ? z->req_comp : z->s->img_n >= 3 ? 3 : 1;
+   *is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   if (z->s->img_n == 3 && *n < 3 && !*is_rgb)
+      *decode_n = 1;
+   else
+      *decode_n = z->s->img_n;
+}
+
+// allocate the output image and line buffers and set up the resamplers for
+// output row 0. Called either at the start of a scan that stbi__jpeg_can_fuse
+// accepts, or after the last scan; calling it again (if the format turned
+// out different) keeps the buffers
+static int stbi__jpeg_start_output(stbi__jpeg *z)
+{
+   int k;
+   stbi__jpeg_output_format(z, &z->out_n, &z->decode_n, &z->is_rgb);
+   for (k=0; k < z->decode_n; ++k) {
+      stbi__resample *r = &z->res_comp[k];
+
+      // allocate line buffer big enough for upsampling off the edges
+      // with upsample factor of 4
+      if (!z->img_comp[k].linebuf)
+         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
+      if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+      r->ypos    = 0;
+      r->line0   = r->line1 = z->img_comp[k].data;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+
+   if (!z->output)
+      z->output = (stbi_uc *) stbi__malloc_out_mad3(z->s, z->out_n, z->s->img_x, z->s->img_y, 1, 8);
+   if (!z->output) return stbi__err("outofmem", "Out of memory");
+   // a freshly allocated output has a spare byte after the last row for the
+   // throwaway alpha of the 1- and 3-channel writers; the caller's buffer doesn't
+   if (z->output == z->s->out_buffer && (z->out_n == 1 || z->out_n == 3) && !z->last_row) {
+      z->last_row = (stbi_uc *) stbi__malloc_mad2(z->s->img_x, z->out_n, 1);
+      if (!z->last_row) return stbi__err("outofmem", "Out of memory");
+   }
+   z->rows_done = 0;
+   return 1;
+}
+
+// fuse the scan just started if it is the only one (baseline, with every
+// component interleaved) and the conversion wouldn't be split into bands
+// anyway. The parallel scan decoder never fuses; the rows are then all
+// converted afterwards
+static int stbi__jpeg_can_fuse(stbi__jpeg *z)
+{
+   int n, decode_n, is_rgb;
+   stbi__jpeg_output_format(z, &n, &decode_n, &is_rgb);
+   return !z->progressive && z->scan_n > 1 && z->scan_n == z->s->img_n && decode_n > 0 &&
+          stbi__jpeg_convert_bands(z) < 2;
+}
+
+// convert the output rows that the first mcu_rows MCU rows of a fused scan
+// are enough for
+static void stbi__jpeg_convert_ready(stbi__jpeg *z, int mcu_rows)
+{
+   int k, y1 = z->s->img_y;
+   if (mcu_rows < z->img_mcu_y) {
+      for (k=0; k < z->decode_n; ++k) {
+         // output row y reads component rows up to ((vs>>1) + y) / vs
+         stbi__resample *r = &z->res_comp[k];
+         int rows = mcu_rows * z->img_comp[k].v * 8;
+         int ready = rows * r->vs - (r->vs >> 1);
+         if (ready < y1) y1 = ready;
+      }
+   }
+   if (y1 > z->rows_done) {
+      stbi_uc *linebuf[4];
+      for (k=0; k < z->decode_n; ++k)
+         linebuf[k] = z->img_comp[k].linebuf;
+      stbi__jpeg_convert_rows(z, z->res_comp, linebuf, y1 == (int) z->s->img_y ? z->last_row : NULL, z->output, z->out_n,
+                              z->decode_n, z->is_rgb, z->rows_done, y1);
+      z->rows_done = y1;
+   }
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   int n, decode_n, is_rgb;
+   stbi_uc *output;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+   z->req_comp = req_comp;
+
+   // load a jpeg image from whichever source, but leave in YCbCr format
+   // (or, for a fused scan, already converted)
+   if (!stbi__decode_jpeg_image(z)) { stbi__free_out(z->s, z->output); stbi__cleanup_jpeg(z); return NULL; }
+
+   stbi__jpeg_output_format(z, &n, &decode_n, &is_rgb);
+
+   // nothing to do if no components requested; check this now to avoid
+   // accessing uninitialized coutput[0] later
+   if (decode_n <= 0) { stbi__free_out(z->s, z->output); stbi__cleanup_jpeg(z); return NULL; }
+
+   // resample and color-convert whatever a fused scan hasn't; markers after
+   // the scan header could in principle still change the format
+   if (!z->output || n != z->out_n || decode_n != z->decode_n || is_rgb != z->is_rgb) {
+      if (!stbi__jpeg_start_output(z)) { stbi__free_out(z->s, z->output); stbi__cleanup_jpeg(z); return NULL; }
+   }
+   if (z->rows_done > 0 || !stbi__jpeg_convert_parallel(z, z->res_comp, z->output, n, decode_n, is_rgb)) {
+      stbi_uc *linebuf[4];
+      int k;
+      for (k=0; k < decode_n; ++k)
+         linebuf[k] = z->img_comp[k].linebuf;
+      stbi__jpeg_convert_rows(z, z->res_comp, linebuf, z->last_row, z->output, n, decode_n, is_rgb, z->rows_done, z->s->img_y);
+   }
+   output = z->output;
+   z->output = NULL;
+   stbi__cleanup_jpeg(z);
+   *out_x = z->s->img_x;
+   *out_y = z->s->img_y;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+   return output;
+}
+
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    unsigned char* result;
@@ -4035,7 +5429,7 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    j->s = s;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
 
@@ -4049,7 +5443,7 @@ static int stbi__jpeg_test(stbi__context *s)
    stbi__setup_jpeg(j);
    r = stbi__decode_jpeg_header(j, STBI__SCAN_type);
    stbi__rewind(s);
-   STBI_FREE(j);
+   stbi__free(j);
    return r;
 }
 
@@ -4073,7 +5467,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    memset(j, 0, sizeof(stbi__jpeg));
    j->s = s;
    result = stbi__jpeg_info_raw(j, x, y, comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
 #endif
@@ -4084,6 +5478,8 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
 //      - fast huffman
+//      - 64-bit bit buffer; the literal/length table resolves two literals or
+//        a whole match length per lookup (see stbi__zinflate_fast)
 
 #ifndef STBI_NO_ZLIB
 
@@ -4091,6 +5487,9 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
+#define STBI__ZLIT_BITS   11 // multi-symbol literal/length table, see stbi__zbuild_lit_table
+#define STBI__ZLIT_MASK   ((1 << STBI__ZLIT_BITS) - 1)
+#define STBI__ZFAST_OUT   (258+8) // output room stbi__zinflate_fast needs for any one symbol
 
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
@@ -4179,7 +5578,8 @@ typedef struct
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
    int hit_zeof_once;
-   stbi__uint32 code_buffer;
+   int num_overread; // zero bytes in code_buffer that lie past zbuffer_end
+   stbi__uint64 code_buffer;
 
    char *zout;
    char *zout_start;
@@ -4187,6 +5587,7 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+   stbi__uint32 z_lit[1 << STBI__ZLIT_BITS]; // multi-symbol view of z_length
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
@@ -4202,20 +5603,30 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
 static void stbi__fill_bits(stbi__zbuf *z)
 {
    do {
-      if (z->code_buffer >= (1U << z->num_bits)) {
+      if (z->code_buffer >= ((stbi__uint64) 1 << z->num_bits)) {
         z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
         return;
       }
-      z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
+      if (stbi__zeof(z)) ++z->num_overread;
+      z->code_buffer |= (stbi__uint64) stbi__zget8(z) << z->num_bits;
       z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   } while (z->num_bits <= 48);
+}
+
+// little-endian 8-byte load; compilers turn this into a single mov
+stbi_inline static stbi__uint64 stbi__zload64(const stbi_uc *p)
+{
+   return  (stbi__uint64) p[0]        | ((stbi__uint64) p[1] <<  8) |
+          ((stbi__uint64) p[2] << 16) | ((stbi__uint64) p[3] << 24) |
+          ((stbi__uint64) p[4] << 32) | ((stbi__uint64) p[5] << 40) |
+          ((stbi__uint64) p[6] << 48) | ((stbi__uint64) p[7] << 56);
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) stbi__fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -4226,7 +5637,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -4251,6 +5662,7 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
             // though, that is invalid data. This is caught later.
             a->hit_zeof_once = 1;
             a->num_bits += 16; // add 16 implicit zero bits
+            a->num_overread += 2;
          } else {
             // We already inserted our extra 16 padding bits and are again
             // out, this stream is actually prematurely terminated.
@@ -4283,7 +5695,7 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
       if(limit > UINT_MAX / 2) return stbi__err("outofmem", "Out of memory");
       limit *= 2;
    }
-   q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
+   q = (char *) stbi__realloc_sized(z->zout_start, old_limit, limit);
    STBI_NOTUSED(old_limit);
    if (q == NULL) return stbi__err("outofmem", "Out of memory");
    z->zout_start = q;
@@ -4306,11 +5718,151 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// z_lit entries: bits 0-7 are the code bits to consume, bits 8-9 the kind,
+// bits 12-15 the length extra bits still to read, bits 16-31 the payload (one
+// or two literal bytes, or a match length). 0 sends the symbol down the slow
+// path: codes longer than STBI__ZLIT_BITS, end of block and invalid codes.
+#define STBI__ZLIT_ONE   0x100
+#define STBI__ZLIT_TWO   0x200
+#define STBI__ZLIT_LEN   0x300
+#define STBI__ZLIT_KIND  0x300
+
+static void stbi__zbuild_lit_table(stbi__zbuf *a)
+{
+   stbi__zhuffman *z = &a->z_length;
+   stbi__uint32 *t = a->z_lit;
+   int s, c, j;
+   memset(t, 0, sizeof(a->z_lit));
+   for (s=1; s <= STBI__ZLIT_BITS; ++s) {
+      // symbols of each code size are consecutive in value[] (see stbi__zbuild_huffman)
+      for (c=z->firstsymbol[s]; c < z->firstsymbol[s+1]; ++c) {
+         int v = z->value[c];
+         int code = z->firstcode[s] + (c - z->firstsymbol[s]);
+         if (v == 256 || v >= 286) continue;
+         for (j=stbi__bit_reverse(code, s); j < (1 << STBI__ZLIT_BITS); j += (1 << s)) {
+            if (v < 256) {
+               t[j] = STBI__ZLIT_ONE | s | (v << 16);
+            } else {
+               int extra = stbi__zlength_extra[v-257];
+               int len = stbi__zlength_base[v-257];
+               if (s + extra <= STBI__ZLIT_BITS) // the extra bits are in the index too
+                  t[j] = STBI__ZLIT_LEN | (s + extra) | ((len + ((j >> s) & ((1 << extra) - 1))) << 16);
+               else
+                  t[j] = STBI__ZLIT_LEN | s | (extra << 12) | (len << 16);
+            }
+         }
+      }
+   }
+   // pair up literals whose two codes fit in the index; go downwards since
+   // j >> s < j must still hold its single-literal entry
+   for (j=(1 << STBI__ZLIT_BITS)-1; j >= 0; --j) {
+      stbi__uint32 e = t[j], e2;
+      if ((e & STBI__ZLIT_KIND) != STBI__ZLIT_ONE) continue;
+      s = e & 255;
+      e2 = t[j >> s];
+      if ((e2 & STBI__ZLIT_KIND) == STBI__ZLIT_ONE && s + (int) (e2 & 255) <= STBI__ZLIT_BITS)
+         t[j] = STBI__ZLIT_TWO | (s + (e2 & 255)) | (e & 0xff0000) | ((e2 & 0xff0000) << 8);
+   }
+}
+
+// Decodes symbols while at least 8 input bytes and STBI__ZFAST_OUT output
+// bytes are left, with one branchless 64-bit refill per table lookup: a
+// lookup yields two literals or a match length, and the length, distance and
+// their extra bits all fit in the >= 56 bits a refill guarantees. Returns at
+// anything the tables don't resolve, or that is invalid, without consuming
+// it, so that stbi__parse_huffman_block decodes it (and reports errors) the
+// careful way.
+static char *stbi__zinflate_fast(stbi__zbuf *a, char *zout)
+{
+   stbi__uint64 cb = a->code_buffer;
+   int nb = a->num_bits;
+   stbi_uc *in = a->zbuffer;
+   const stbi__uint32 *lit = a->z_lit;
+   const stbi__uint16 *dfast = a->z_distance.fast;
+   while (a->zbuffer_end - in >= 8 && a->zout_end - zout >= STBI__ZFAST_OUT) {
+      stbi__uint32 e;
+      stbi__uint64 bits;
+      int s, used, len, extra, d, dist;
+      char *p, *end;
+      // whole bytes go below bit 64; the part of a byte that doesn't fit is
+      // or'ed in again by the next refill
+      cb |= stbi__zload64(in) << nb;
+      in += (63 - nb) >> 3;
+      nb |= 56;
+
+      e = lit[cb & STBI__ZLIT_MASK];
+      s = e & 255;
+      if ((e & STBI__ZLIT_KIND) == STBI__ZLIT_ONE) {
+         cb >>= s; nb -= s;
+         *zout++ = (char) (e >> 16);
+         continue;
+      }
+      if ((e & STBI__ZLIT_KIND) == STBI__ZLIT_TWO) {
+         cb >>= s; nb -= s;
+         zout[0] = (char) (e >> 16);
+         zout[1] = (char) (e >> 24);
+         zout += 2;
+         continue;
+      }
+      if (!e) break;
+
+      len = e >> 16;
+      extra = (e >> 12) & 15;
+      bits = cb >> s;
+      used = s;
+      if (extra) {
+         len += (int) (bits & ((1 << extra) - 1));
+         bits >>= extra;
+         used += extra;
+      }
+      d = dfast[bits & STBI__ZFAST_MASK];
+      if (!d || (d & 511) >= 30) break;
+      bits >>= d >> 9;
+      used += d >> 9;
+      d &= 511;
+      dist = stbi__zdist_base[d];
+      if (stbi__zdist_extra[d]) {
+         dist += (int) (bits & ((1 << stbi__zdist_extra[d]) - 1));
+         used += stbi__zdist_extra[d];
+      }
+      if (zout - a->zout_start < dist) break;
+      cb >>= used; nb -= used;
+
+      p = zout - dist;
+      end = zout + len;
+      if (dist == 1) { // run of one byte; common in images.
+         memset(zout, *p, len);
+      } else {
+         if (dist < 8) {
+            // the match repeats with period dist, so once step - dist bytes
+            // are out it can be copied from a multiple of dist at least 8 back
+            int step = (8 + dist - 1) / dist * dist;
+            while (zout < end && zout - (end - len) < step - dist) *zout++ = *p++;
+            p = zout - step;
+         }
+         // may write up to 7 bytes past end; STBI__ZFAST_OUT leaves room
+         while (zout < end) {
+            memcpy(zout, p, 8);
+            zout += 8;
+            p += 8;
+         }
+      }
+      zout = end;
+   }
+   a->zbuffer = in;
+   a->code_buffer = cb & (((stbi__uint64) 1 << nb) - 1);
+   a->num_bits = nb;
+   return zout;
+}
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
+      int z;
+      if (a->zbuffer_end - a->zbuffer >= 8 && a->zout_end - zout >= STBI__ZFAST_OUT)
+         zout = stbi__zinflate_fast(a, zout);
+      z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
@@ -4403,6 +5955,7 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
    if (n != ntot) return stbi__err("bad codelengths","Corrupt PNG");
    if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!stbi__zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+   stbi__zbuild_lit_table(a);
    return 1;
 }
 
@@ -4414,12 +5967,20 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
       stbi__zreceive(a, a->num_bits & 7); // discard
    // drain the bit-packed data into header
    k = 0;
-   while (a->num_bits > 0) {
+   while (a->num_bits > 0 && k < 4) {
       header[k++] = (stbi_uc) (a->code_buffer & 255); // suppress MSVC run-time check
       a->code_buffer >>= 8;
       a->num_bits -= 8;
    }
    if (a->num_bits < 0) return stbi__err("zlib corrupt","Corrupt PNG");
+   // hand back whole bytes read ahead of the header; any zero bytes past the
+   // end of the input are the last ones in
+   if (a->num_bits > 0) {
+      int ahead = (a->num_bits >> 3) - a->num_overread;
+      if (ahead > 0) a->zbuffer -= ahead;
+      a->code_buffer = 0;
+      a->num_bits = 0;
+   }
    // now fill header the normal way
    while (k < 4)
       header[k++] = stbi__zget8(a);
@@ -4486,6 +6047,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
    a->num_bits = 0;
    a->code_buffer = 0;
    a->hit_zeof_once = 0;
+   a->num_overread = 0;
    do {
       final = stbi__zreceive(a,1);
       type = stbi__zreceive(a,2);
@@ -4498,6 +6060,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
             // use fixed code lengths
             if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , STBI__ZNSYMS)) return 0;
             if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+            stbi__zbuild_lit_table(a);
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
@@ -4528,7 +6091,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4549,7 +6112,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4576,7 +6139,7 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4632,8 +6195,17 @@ typedef struct
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   int out_final; // the next image allocated is the result, see stbi__png_malloc_out
 } stbi__png;
 
+// a->out for an image that is the result, rather than an input to palette
+// expansion or channel conversion, may be the caller's buffer
+static void *stbi__png_malloc_out(stbi__png *a, int x, int y, int bytes_per_pixel)
+{
+   if (!a->out_final) return stbi__malloc_mad3(x, y, bytes_per_pixel, 0);
+   return stbi__malloc_out_mad3(a->s, x, y, bytes_per_pixel, 0, a->depth == 16 ? 16 : 8);
+}
+
 
 enum {
    STBI__F_none=0,
@@ -4692,6 +6264,179 @@ static void stbi__create_png_alpha_expand8(stbi_uc *dest, stbi_uc *src, stbi__ui
    }
 }
 
+// undo one row's filter: cur gets nk bytes of raw plus the prediction from
+// the pixel filter_bytes to the left (in cur) and the row above (prior)
+static void stbi__png_unfilter_row(stbi_uc *cur, stbi_uc const *raw, stbi_uc const *prior, int nk, int filter, int filter_bytes)
+{
+   int k;
+   switch (filter) {
+   case STBI__F_none:
+      memcpy(cur, raw, nk);
+      break;
+   case STBI__F_sub:
+      memcpy(cur, raw, filter_bytes);
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]);
+      break;
+   case STBI__F_up:
+      for (k = 0; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      break;
+   case STBI__F_avg:
+      for (k = 0; k < filter_bytes; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1));
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1));
+      break;
+   case STBI__F_paeth:
+      for (k = 0; k < filter_bytes; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]); // prior[k] == stbi__paeth(0,prior[k],0)
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes], prior[k], prior[k-filter_bytes]));
+      break;
+   case STBI__F_avg_first:
+      memcpy(cur, raw, filter_bytes);
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1));
+      break;
+   }
+}
+
+#ifdef STBI_SSE2
+// one pixel of bpp (3, 4, 6 or 8) bytes to or from the low bytes of a
+// register, never touching memory past the pixel
+static __m128i stbi__png_load_pixel(stbi_uc const *p, int bpp)
+{
+   stbi__uint32 lo = 0;
+   stbi__uint16 hi;
+   switch (bpp) {
+   case 3:
+      memcpy(&lo, p, 3);
+      return _mm_cvtsi32_si128((int) lo);
+   case 4:
+      memcpy(&lo, p, 4);
+      return _mm_cvtsi32_si128((int) lo);
+   case 6:
+      memcpy(&lo, p, 4);
+      memcpy(&hi, p+4, 2);
+      return _mm_unpacklo_epi32(_mm_cvtsi32_si128((int) lo), _mm_cvtsi32_si128(hi));
+   default:
+      return _mm_loadl_epi64((__m128i const *) p);
+   }
+}
+
+static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int bpp)
+{
+   stbi__uint32 lo = (stbi__uint32) _mm_cvtsi128_si32(v);
+   stbi__uint16 hi;
+   switch (bpp) {
+   case 3:
+      memcpy(p, &lo, 3);
+      break;
+   case 4:
+      memcpy(p, &lo, 4);
+      break;
+   case 6:
+      hi = (stbi__uint16) _mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+      memcpy(p, &lo, 4);
+      memcpy(p+4, &hi, 2);
+      break;
+   default:
+      _mm_storel_epi64((__m128i *) p, v);
+      break;
+   }
+}
+
+// sse2 version of stbi__png_unfilter_row for 3..8 byte pixels, with the same
+// output. Up works 16 bytes at a time; Sub, Avg and Paeth depend on the
+// pixel to the left, so they run a whole pixel (all channels) per step and
+// carry that pixel along in a register
+static void stbi__png_unfilter_row_simd(stbi_uc *cur, stbi_uc const *raw, stbi_uc const *prior, int nk, int filter, int bpp)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = zero; // left, already unfiltered
+   int k = 0;
+
+   // run body once per pixel with x and b (the raw and above pixels) loaded
+   // and a stored afterwards. While 8 bytes are left that is done with
+   // 8-byte loads and stores: the bytes past the pixel are don't-care in
+   // every lane-wise step, and the next pixel overwrites what was stored
+   #define stbi__png_pixel_loop(body) \
+      for (; k+8 <= nk; k += bpp) { \
+         __m128i x = _mm_loadl_epi64((__m128i const *) (raw+k)); \
+         __m128i b = _mm_loadl_epi64((__m128i const *) (prior+k)); \
+         body \
+         _mm_storel_epi64((__m128i *) (cur+k), a); \
+      } \
+      for (; k < nk; k += bpp) { \
+         __m128i x = stbi__png_load_pixel(raw+k, bpp); \
+         __m128i b = stbi__png_load_pixel(prior+k, bpp); \
+         body \
+         stbi__png_store_pixel(cur+k, a, bpp); \
+      }
+
+   switch (filter) {
+   case STBI__F_none:
+      memcpy(cur, raw, nk);
+      break;
+   case STBI__F_sub:
+      stbi__png_pixel_loop(
+         STBI_NOTUSED(b);
+         a = _mm_add_epi8(a, x);
+      )
+      break;
+   case STBI__F_up:
+      for (; k+16 <= nk; k += 16) {
+         __m128i x = _mm_loadu_si128((__m128i const *) (raw+k));
+         __m128i b = _mm_loadu_si128((__m128i const *) (prior+k));
+         _mm_storeu_si128((__m128i *) (cur+k), _mm_add_epi8(x, b));
+      }
+      for (; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      break;
+   case STBI__F_avg:
+      // (a+b)>>1 is the rounding-up average minus the bit it rounded
+      stbi__png_pixel_loop(
+         __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+         a = _mm_add_epi8(avg, x);
+      )
+      break;
+   case STBI__F_avg_first:
+      stbi__png_pixel_loop(
+         STBI_NOTUSED(b);
+         a = _mm_add_epi8(_mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(0x7f)), x);
+      )
+      break;
+   case STBI__F_paeth:
+      // stbi__paeth in 16-bit lanes, keeping the left pixel widened so that
+      // only thresh, the two selects and the add wait on it; a holds the
+      // packed copy for the store
+      {
+         __m128i a16 = zero, c16 = zero;
+         __m128i lowbyte = _mm_set1_epi16(0xff);
+         stbi__png_pixel_loop(
+            __m128i b16 = _mm_unpacklo_epi8(b, zero);
+            __m128i x16 = _mm_unpacklo_epi8(x, zero);
+            __m128i c3b = _mm_sub_epi16(_mm_add_epi16(c16, _mm_add_epi16(c16, c16)), b16);
+            __m128i thresh = _mm_sub_epi16(c3b, a16); // c*3 - (a + b)
+            __m128i lo = _mm_min_epi16(a16, b16);
+            __m128i hi = _mm_max_epi16(a16, b16);
+            __m128i use_c = _mm_cmpgt_epi16(hi, thresh);
+            __m128i t0 = _mm_or_si128(_mm_and_si128(use_c, c16), _mm_andnot_si128(use_c, lo));
+            __m128i use_t0 = _mm_cmpgt_epi16(thresh, lo);
+            __m128i t1 = _mm_or_si128(_mm_and_si128(use_t0, t0), _mm_andnot_si128(use_t0, hi));
+            a16 = _mm_and_si128(_mm_add_epi16(t1, x16), lowbyte);
+            a = _mm_packus_epi16(a16, a16);
+            c16 = b16;
+         )
+      }
+      break;
+   }
+
+   #undef stbi__png_pixel_loop
+}
+#endif
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
@@ -4701,7 +6446,6 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    stbi__uint32 img_len, img_width_bytes;
    stbi_uc *filter_buf;
    int all_ok = 1;
-   int k;
    int img_n = s->img_n; // copy it into a local for later
 
    int output_bytes = out_n*bytes;
@@ -4709,7 +6453,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int width = x;
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
+   a->out = (stbi_uc *) stbi__png_malloc_out(a, x, y, output_bytes);
    if (!a->out) return stbi__err("outofmem", "Out of memory");
 
    // note: error exits here don't need to clean up a->out individually,
@@ -4752,37 +6496,12 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       if (j == 0) filter = first_row_filter[filter];
 
       // perform actual filtering
-      switch (filter) {
-      case STBI__F_none:
-         memcpy(cur, raw, nk);
-         break;
-      case STBI__F_sub:
-         memcpy(cur, raw, filter_bytes);
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]);
-         break;
-      case STBI__F_up:
-         for (k = 0; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
-         break;
-      case STBI__F_avg:
-         for (k = 0; k < filter_bytes; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1));
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1));
-         break;
-      case STBI__F_paeth:
-         for (k = 0; k < filter_bytes; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + prior[k]); // prior[k] == stbi__paeth(0,prior[k],0)
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes], prior[k], prior[k-filter_bytes]));
-         break;
-      case STBI__F_avg_first:
-         memcpy(cur, raw, filter_bytes);
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1));
-         break;
-      }
+#ifdef STBI_SSE2
+      if (depth >= 8 && (filter_bytes == 3 || filter_bytes == 4 || filter_bytes == 6 || filter_bytes == 8) && stbi__sse2_available())
+         stbi__png_unfilter_row_simd(cur, raw, prior, nk, filter, filter_bytes);
+      else
+#endif
+         stbi__png_unfilter_row(cur, raw, prior, nk, filter, filter_bytes);
 
       raw += nk;
 
@@ -4852,12 +6571,35 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       }
    }
 
-   STBI_FREE(filter_buf);
+   stbi__free(filter_buf);
    if (!all_ok) return 0;
 
    return 1;
 }
 
+// Adam7 passes: origin and spacing of each pass in the full image
+static const int stbi__png_xorig[7] = { 0,4,0,2,0,1,0 };
+static const int stbi__png_yorig[7] = { 0,0,4,0,2,0,1 };
+static const int stbi__png_xspc[7]  = { 8,8,4,4,2,2,1 };
+static const int stbi__png_yspc[7]  = { 8,8,8,4,4,2,2 };
+
+// exact size of the decompressed image data, filter bytes included, so the
+// inflater can allocate it once
+static stbi__uint32 stbi__png_raw_size(stbi__context *s, int depth, int interlaced)
+{
+   stbi__uint32 len = 0;
+   int p;
+   if (!interlaced)
+      return ((((s->img_n * s->img_x * depth) + 7) >> 3) + 1) * s->img_y;
+   for (p=0; p < 7; ++p) {
+      stbi__uint32 x = (s->img_x - stbi__png_xorig[p] + stbi__png_xspc[p]-1) / stbi__png_xspc[p];
+      stbi__uint32 y = (s->img_y - stbi__png_yorig[p] + stbi__png_yspc[p]-1) / stbi__png_yspc[p];
+      if (x && y)
+         len += ((((s->img_n * x * depth) + 7) >> 3) + 1) * y;
+   }
+   return len;
+}
+
 static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint32 image_data_len, int out_n, int depth, int color, int interlaced)
 {
    int bytes = (depth == 16 ? 2 : 1);
@@ -4867,14 +6609,13 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    if (!interlaced)
       return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color);
 
-   // de-interlacing
-   final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
+   // de-interlacing; the passes are scratch
+   final = (stbi_uc *) stbi__png_malloc_out(a, a->s->img_x, a->s->img_y, out_bytes);
    if (!final) return stbi__err("outofmem", "Out of memory");
+   a->out_final = 0;
    for (p=0; p < 7; ++p) {
-      int xorig[] = { 0,4,0,2,0,1,0 };
-      int yorig[] = { 0,0,4,0,2,0,1 };
-      int xspc[]  = { 8,8,4,4,2,2,1 };
-      int yspc[]  = { 8,8,8,4,4,2,2 };
+      const int *xorig = stbi__png_xorig, *yorig = stbi__png_yorig;
+      const int *xspc = stbi__png_xspc, *yspc = stbi__png_yspc;
       int i,j,x,y;
       // pass1_x[4] = 0, pass1_x[5] = 1, pass1_x[12] = 1
       x = (a->s->img_x - xorig[p] + xspc[p]-1) / xspc[p];
@@ -4882,7 +6623,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
          if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
-            STBI_FREE(final);
+            stbi__free_out(a->s, final);
             return 0;
          }
          for (j=0; j < y; ++j) {
@@ -4893,7 +6634,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
          }
-         STBI_FREE(a->out);
+         stbi__free(a->out);
          image_data += img_len;
          image_data_len -= img_len;
       }
@@ -4958,7 +6699,7 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
    stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
    stbi_uc *p, *temp_out, *orig = a->out;
 
-   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+   p = (stbi_uc *) stbi__png_malloc_out(a, a->s->img_x, a->s->img_y, pal_img_n);
    if (p == NULL) return stbi__err("outofmem", "Out of memory");
 
    // between here and free(out) below, exitting would leak
@@ -4982,7 +6723,7 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
          p += 4;
       }
    }
-   STBI_FREE(a->out);
+   stbi__free(a->out);
    a->out = temp_out;
 
    STBI_NOTUSED(len);
@@ -5030,6 +6771,9 @@ STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_conve
                                 : stbi__de_iphone_flag_global)
 #endif // STBI_THREAD_LOCAL
 
+#define stbi__unpremultiply_enabled(s)  ((s)->opt ? (s)->opt->unpremultiply : stbi__unpremultiply_on_load)
+#define stbi__de_iphone_enabled(s)      ((s)->opt ? (s)->opt->convert_iphone_png_to_rgb : stbi__de_iphone_flag)
+
 static void stbi__de_iphone(stbi__png *z)
 {
    stbi__context *s = z->s;
@@ -5045,7 +6789,7 @@ static void stbi__de_iphone(stbi__png *z)
       }
    } else {
       STBI_ASSERT(s->img_out_n == 4);
-      if (stbi__unpremultiply_on_load) {
+      if (stbi__unpremultiply_enabled(s)) {
          // convert bgr to rgb and unpremultiply
          for (i=0; i < pixel_count; ++i) {
             stbi_uc a = p[3];
@@ -5087,6 +6831,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
    z->expanded = NULL;
    z->idata = NULL;
    z->out = NULL;
+   z->out_final = 0;
 
    if (!stbi__check_png_header(s)) return 0;
 
@@ -5188,7 +6933,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
                STBI_NOTUSED(idata_limit_old);
-               p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+               p = (stbi_uc *) stbi__realloc_sized(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
@@ -5197,20 +6942,21 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
          }
 
          case STBI__PNG_TYPE('I','E','N','D'): {
-            stbi__uint32 raw_len, bpl;
+            stbi__uint32 raw_len;
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (scan != STBI__SCAN_load) return 1;
             if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
-            // initial guess for decoded data size to avoid unnecessary reallocs
-            bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
-            raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
+            // IHDR gives the exact decoded size, so the output is allocated
+            // once; it stays expandable for files with trailing data
+            raw_len = stbi__png_raw_size(s, z->depth, interlace);
             z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
+            stbi__free(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
+            z->out_final = !pal_img_n && (req_comp == 0 || req_comp == s->img_out_n);
             if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
             if (has_trans) {
                if (z->depth == 16) {
@@ -5219,20 +6965,21 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                   if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
                }
             }
-            if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
+            if (is_iphone && stbi__de_iphone_enabled(s) && s->img_out_n > 2)
                stbi__de_iphone(z);
             if (pal_img_n) {
                // pal_img_n == 3 or 4
                s->img_n = pal_img_n; // record the actual colors we had
                s->img_out_n = pal_img_n;
                if (req_comp >= 3) s->img_out_n = req_comp;
+               z->out_final = req_comp == 0 || req_comp == s->img_out_n;
                if (!stbi__expand_png_palette(z, palette, pal_len, s->img_out_n))
                   return 0;
             } else if (has_trans) {
                // non-paletted image with tRNS -> source image has (constant) alpha
                ++s->img_n;
             }
-            STBI_FREE(z->expanded); z->expanded = NULL;
+            stbi__free(z->expanded); z->expanded = NULL;
             // end of PNG chunk, read and skip CRC
             stbi__get32be(s);
             return 1;
@@ -5285,9 +7032,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   STBI_FREE(p->out);      p->out      = NULL;
-   STBI_FREE(p->expanded); p->expanded = NULL;
-   STBI_FREE(p->idata);    p->idata    = NULL;
+   stbi__free_out(p->s, p->out); p->out = NULL;
+   stbi__free(p->expanded); p->expanded = NULL;
+   stbi__free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -5598,7 +7345,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (info.bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { STBI_FREE(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi__free(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = stbi__get8(s);
          pal[i][1] = stbi__get8(s);
@@ -5610,7 +7357,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       if (info.bpp == 1) width = (s->img_x + 7) >> 3;
       else if (info.bpp == 4) width = (s->img_x + 1) >> 1;
       else if (info.bpp == 8) width = s->img_x;
-      else { STBI_FREE(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
+      else { stbi__free(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       if (info.bpp == 1) {
          for (j=0; j < (int) s->img_y; ++j) {
@@ -5667,13 +7414,13 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = stbi__high_bit(mr)-7; rcount = stbi__bitcount(mr);
          gshift = stbi__high_bit(mg)-7; gcount = stbi__bitcount(mg);
          bshift = stbi__high_bit(mb)-7; bcount = stbi__bitcount(mb);
          ashift = stbi__high_bit(ma)-7; acount = stbi__bitcount(ma);
-         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
       }
       for (j=0; j < (int) s->img_y; ++j) {
          if (easy) {
@@ -5941,7 +7688,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       if ( tga_indexed)
       {
          if (tga_palette_len == 0) {  /* you have to have at least one entry! */
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("bad palette", "Corrupt TGA");
          }
 
@@ -5950,7 +7697,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
          //   load the palette
          tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
          if (!tga_palette) {
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("outofmem", "Out of memory");
          }
          if (tga_rgb16) {
@@ -5961,8 +7708,8 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                pal_entry += tga_comp;
             }
          } else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
-               STBI_FREE(tga_data);
-               STBI_FREE(tga_palette);
+               stbi__free(tga_data);
+               stbi__free(tga_palette);
                return stbi__errpuc("bad palette", "Corrupt TGA");
          }
       }
@@ -6043,7 +7790,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       //   clear my palette, if I had one
       if ( tga_palette != NULL )
       {
-         STBI_FREE( tga_palette );
+         stbi__free( tga_palette );
       }
    }
 
@@ -6235,7 +7982,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
          } else {
             // Read the RLE data.
             if (!stbi__psd_decode_rle(s, p, pixelCount)) {
-               STBI_FREE(out);
+               stbi__free(out);
                return stbi__errpuc("corrupt", "bad RLE data");
             }
          }
@@ -6527,7 +8274,7 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
    memset(result, 0xff, x*y*4);
 
    if (!stbi__pic_load_core(s,x,y,comp, result)) {
-      STBI_FREE(result);
+      stbi__free(result);
       result=0;
    }
    *px = x;
@@ -6641,13 +8388,13 @@ static int stbi__gif_info_raw(stbi__context *s, int *x, int *y, int *comp)
    stbi__gif* g = (stbi__gif*) stbi__malloc(sizeof(stbi__gif));
    if (!g) return stbi__err("outofmem", "Out of memory");
    if (!stbi__gif_header(s, g, comp, 1)) {
-      STBI_FREE(g);
+      stbi__free(g);
       stbi__rewind( s );
       return 0;
    }
    if (x) *x = g->w;
    if (y) *y = g->h;
-   STBI_FREE(g);
+   stbi__free(g);
    return 1;
 }
 
@@ -6951,12 +8698,12 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
 
 static void *stbi__load_gif_main_outofmem(stbi__gif *g, stbi_uc *out, int **delays)
 {
-   STBI_FREE(g->out);
-   STBI_FREE(g->history);
-   STBI_FREE(g->background);
+   stbi__free(g->out);
+   stbi__free(g->history);
+   stbi__free(g->background);
 
-   if (out) STBI_FREE(out);
-   if (delays && *delays) STBI_FREE(*delays);
+   if (out) stbi__free(out);
+   if (delays && *delays) stbi__free(*delays);
    return stbi__errpuc("outofmem", "Out of memory");
 }
 
@@ -6991,7 +8738,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
             stride = g.w * g.h * 4;
 
             if (out) {
-               void *tmp = (stbi_uc*) STBI_REALLOC_SIZED( out, out_size, layers * stride );
+               void *tmp = (stbi_uc*) stbi__realloc_sized( out, out_size, layers * stride );
                if (!tmp)
                   return stbi__load_gif_main_outofmem(&g, out, delays);
                else {
@@ -7000,7 +8747,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
                }
 
                if (delays) {
-                  int *new_delays = (int*) STBI_REALLOC_SIZED( *delays, delays_size, sizeof(int) * layers );
+                  int *new_delays = (int*) stbi__realloc_sized( *delays, delays_size, sizeof(int) * layers );
                   if (!new_delays)
                      return stbi__load_gif_main_outofmem(&g, out, delays);
                   *delays = new_delays;
@@ -7030,9 +8777,9 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
       } while (u != 0);
 
       // free temp buffer;
-      STBI_FREE(g.out);
-      STBI_FREE(g.history);
-      STBI_FREE(g.background);
+      stbi__free(g.out);
+      stbi__free(g.history);
+      stbi__free(g.background);
 
       // do the final conversion after loading everything;
       if (req_comp && req_comp != 4)
@@ -7064,12 +8811,12 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
          u = stbi__convert_format(u, 4, req_comp, g.w, g.h);
    } else if (g.out) {
       // if there was an error and we allocated an image buffer, free it!
-      STBI_FREE(g.out);
+      stbi__free(g.out);
    }
 
    // free buffers needed for multiple frame loading;
-   STBI_FREE(g.history);
-   STBI_FREE(g.background);
+   stbi__free(g.history);
+   stbi__free(g.background);
 
    return u;
 }
@@ -7242,16 +8989,16 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
             stbi__hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            STBI_FREE(scanline);
+            stbi__free(scanline);
             goto main_decode_loop; // yes, this makes no sense
          }
          len <<= 8;
          len |= stbi__get8(s);
-         if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
+         if (len != width) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
          if (scanline == NULL) {
             scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
             if (!scanline) {
-               STBI_FREE(hdr_data);
+               stbi__free(hdr_data);
                return stbi__errpf("outofmem", "Out of memory");
             }
          }
@@ -7265,12 +9012,12 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                   // Run
                   value = stbi__get8(s);
                   count -= 128;
-                  if ((count == 0) || (count > nleft)) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  if ((count == 0) || (count > nleft)) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                   for (z = 0; z < count; ++z)
                      scanline[i++ * 4 + k] = value;
                } else {
                   // Dump
-                  if ((count == 0) || (count > nleft)) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  if ((count == 0) || (count > nleft)) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                   for (z = 0; z < count; ++z)
                      scanline[i++ * 4 + k] = stbi__get8(s);
                }
@@ -7280,7 +9027,7 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
             stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
       }
       if (scanline)
-         STBI_FREE(scanline);
+         stbi__free(scanline);
    }
 
    return hdr_data;
@@ -7525,7 +9272,7 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
    out = (stbi_uc *) stbi__malloc_mad4(s->img_n, s->img_x, s->img_y, ri->bits_per_channel / 8, 0);
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (!stbi__getn(s, out, s->img_n * s->img_x * s->img_y * (ri->bits_per_channel / 8))) {
-      STBI_FREE(out);
+      stbi__free(out);
       return stbi__errpuc("bad PNM", "PNM file truncated");
    }
 
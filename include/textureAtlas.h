@@ -0,0 +1,377 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include <threadPool.h>
+
+// Packs many small images (stb_image output, all with the same channels)
+// into a few large pages, so a scene binds one texture where it would bind
+// hundreds, and hands back where each image went as a UV remap table.
+//
+// Every image is surrounded by a gutter of its own edge texels, padding
+// wide, so bilinear filtering at its border never reaches a neighbour. For
+// mipmapped pages, mipLevels > 0 also aligns every image's cell (image plus
+// gutter) to 2^mipLevels texels: down to that level, each texel of a mip
+// still averages texels of one image only, and the gutter is extruded to
+// the whole cell so those averages see the image's own edges rather than
+// empty page.
+//
+// Cells are placed with either packer: the skyline keeps only the top edge
+// of what is placed so far and puts each cell where it lands lowest, which
+// is fast; maxrects tracks every free rectangle and picks the tightest fit
+// (best short side), slower but usually denser. Images go in tallest and
+// widest first, onto the first page with room, and a new page is opened
+// when none has.
+enum AtlasPacking
+{
+    ATLAS_SKYLINE,
+    ATLAS_MAXRECTS
+};
+
+struct AtlasSettings
+{
+    int pageSize = 2048; // pages are square
+    int padding = 2;     // gutter texels on each side of an image
+    int mipLevels = 0;   // levels kept free of bleeding between images
+    AtlasPacking packing = ATLAS_MAXRECTS;
+};
+
+// an image to pack, tightly packed rows of nrChannels bytes a texel
+struct AtlasImage
+{
+    int width;
+    int height;
+    const unsigned char* pixels;
+};
+
+// where an image went: texels [x, x + width) x [y, y + height) of page, or
+// [u0, u1) x [v0, v1) in texture coordinates. v counts rows in the order
+// they are stored, so it follows whatever flip the images were loaded with
+struct AtlasRegion
+{
+    int page;
+    int x, y;
+    int width, height;
+    float u0, v0, u1, v1;
+};
+
+// places rectangles on one page; coordinates and sizes in whatever unit the
+// caller uses throughout
+class AtlasPacker
+{
+public:
+    AtlasPacker(int width, int height, AtlasPacking packing)
+        : width(width)
+        , height(height)
+        , packing(packing)
+    {
+        skyline.push_back({ 0, 0, width });
+        freeRects.push_back({ 0, 0, width, height });
+    }
+
+    // a spot for a w x h rectangle, or false if the page has none
+    bool insert(int w, int h, int& x, int& y)
+    {
+        return packing == ATLAS_SKYLINE ? insertSkyline(w, h, x, y) : insertMaxRects(w, h, x, y);
+    }
+
+private:
+    // a stretch of the top edge: [x, x + width) is filled up to y
+    struct Segment
+    {
+        int x, y, width;
+    };
+
+    struct Rect
+    {
+        int x, y, width, height;
+    };
+
+    int width, height;
+    AtlasPacking packing;
+    std::vector<Segment> skyline;
+    std::vector<Rect> freeRects;
+
+    // the height a w-wide rectangle would sit at starting on segment i, or
+    // -1 if it runs off the page
+    int skylineFit(size_t i, int w, int h) const
+    {
+        int x = skyline[i].x;
+        if (x + w > width)
+            return -1;
+        int y = 0;
+        for (int remaining = w; remaining > 0; i++)
+        {
+            y = std::max(y, skyline[i].y);
+            if (y + h > height)
+                return -1;
+            remaining -= skyline[i].width;
+        }
+        return y;
+    }
+
+    // lowest top edge first, then least wasted width
+    bool insertSkyline(int w, int h, int& x, int& y)
+    {
+        int bestTop = INT_MAX, bestWidth = INT_MAX;
+        size_t best = skyline.size();
+        for (size_t i = 0; i < skyline.size(); i++)
+        {
+            int fit = skylineFit(i, w, h);
+            if (fit >= 0 && (fit + h < bestTop || (fit + h == bestTop && skyline[i].width < bestWidth)))
+            {
+                best = i;
+                bestTop = fit + h;
+                bestWidth = skyline[i].width;
+                y = fit;
+            }
+        }
+        if (best == skyline.size())
+            return false;
+        x = skyline[best].x;
+
+        // the new segment replaces what it covers
+        skyline.insert(skyline.begin() + best, { x, y + h, w });
+        for (size_t i = best + 1; i < skyline.size();)
+        {
+            int overlap = x + w - skyline[i].x;
+            if (overlap <= 0)
+                break;
+            if (overlap < skyline[i].width)
+            {
+                skyline[i].x += overlap;
+                skyline[i].width -= overlap;
+                break;
+            }
+            skyline.erase(skyline.begin() + i);
+        }
+        for (size_t i = 0; i + 1 < skyline.size();)
+        {
+            if (skyline[i].y == skyline[i + 1].y)
+            {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.erase(skyline.begin() + i + 1);
+            }
+            else
+            {
+                i++;
+            }
+        }
+        return true;
+    }
+
+    // best short side fit, then best long side fit
+    bool insertMaxRects(int w, int h, int& x, int& y)
+    {
+        int bestShort = INT_MAX, bestLong = INT_MAX;
+        for (const Rect& free : freeRects)
+        {
+            if (free.width < w || free.height < h)
+                continue;
+            int leftX = free.width - w, leftY = free.height - h;
+            int shortSide = std::min(leftX, leftY), longSide = std::max(leftX, leftY);
+            if (shortSide < bestShort || (shortSide == bestShort && longSide < bestLong))
+            {
+                bestShort = shortSide;
+                bestLong = longSide;
+                x = free.x;
+                y = free.y;
+            }
+        }
+        if (bestShort == INT_MAX)
+            return false;
+
+        // split every free rectangle the new one overlaps into the (up to
+        // four) maximal rectangles around it
+        std::vector<Rect> pieces;
+        size_t kept = 0;
+        for (size_t i = 0; i < freeRects.size(); i++)
+        {
+            Rect free = freeRects[i];
+            if (x >= free.x + free.width || x + w <= free.x || y >= free.y + free.height || y + h <= free.y)
+            {
+                freeRects[kept++] = free;
+                continue;
+            }
+            if (x > free.x)
+                pieces.push_back({ free.x, free.y, x - free.x, free.height });
+            if (x + w < free.x + free.width)
+                pieces.push_back({ x + w, free.y, free.x + free.width - x - w, free.height });
+            if (y > free.y)
+                pieces.push_back({ free.x, free.y, free.width, y - free.y });
+            if (y + h < free.y + free.height)
+                pieces.push_back({ free.x, y + h, free.width, free.y + free.height - y - h });
+        }
+        freeRects.resize(kept);
+        // then drop what another rectangle contains; the untouched ones
+        // didn't contain each other before, so only pairs with a new piece
+        // need checking
+        auto contains = [](const Rect& a, const Rect& b) {
+            return b.x >= a.x && b.y >= a.y && b.x + b.width <= a.x + a.width && b.y + b.height <= a.y + a.height;
+        };
+        for (size_t i = 0; i < freeRects.size();)
+        {
+            bool covered = false;
+            for (const Rect& piece : pieces)
+                covered = covered || contains(piece, freeRects[i]);
+            if (covered)
+            {
+                freeRects[i] = freeRects.back();
+                freeRects.pop_back();
+            }
+            else
+            {
+                i++;
+            }
+        }
+        for (size_t i = 0; i < pieces.size(); i++)
+        {
+            bool covered = false;
+            for (const Rect& free : freeRects)
+                covered = covered || contains(free, pieces[i]);
+            // of equal pieces, the first one stays
+            for (size_t j = 0; j < pieces.size() && !covered; j++)
+                covered = j != i && contains(pieces[j], pieces[i]) && (j < i || !contains(pieces[i], pieces[j]));
+            if (!covered)
+                freeRects.push_back(pieces[i]);
+        }
+        return true;
+    }
+};
+
+// the images packed into pages of nrChannels bytes a texel, rows tightly
+// packed, and the region of every image in the order they were given
+struct TextureAtlas
+{
+    int pageSize = 0;
+    int nrChannels = 0;
+    std::vector<std::vector<unsigned char>> pages;
+    std::vector<AtlasRegion> regions;
+};
+
+// where count images of the given sizes go, without any pixels; returns the
+// number of pages, or 0 if an image can't fit on a page at all
+// ----------------------------------------------------------------------------
+inline int atlasLayout(const AtlasImage* images, int count, const AtlasSettings& settings,
+                       std::vector<AtlasRegion>& regions)
+{
+    // packers work in cells of 2^mipLevels texels
+    const int cell = 1 << settings.mipLevels;
+    const int cells = settings.pageSize / cell;
+    auto cellsFor = [&](int size) { return (size + 2 * settings.padding + cell - 1) / cell; };
+
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        int sideA = std::max(images[a].width, images[a].height), sideB = std::max(images[b].width, images[b].height);
+        if (sideA != sideB)
+            return sideA > sideB;
+        return images[a].height > images[b].height;
+    });
+
+    regions.assign(count, AtlasRegion());
+    std::vector<AtlasPacker> packers;
+    for (int index : order)
+    {
+        const AtlasImage& image = images[index];
+        int w = cellsFor(image.width), h = cellsFor(image.height);
+        if (w > cells || h > cells)
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::IMAGE_TOO_LARGE: " << image.width << "x" << image.height
+                      << " for pages of " << settings.pageSize << std::endl;
+            return 0;
+        }
+        int x = 0, y = 0;
+        size_t page = 0;
+        while (page < packers.size() && !packers[page].insert(w, h, x, y))
+            page++;
+        if (page == packers.size())
+        {
+            packers.push_back(AtlasPacker(cells, cells, settings.packing));
+            packers.back().insert(w, h, x, y);
+        }
+        AtlasRegion& region = regions[index];
+        region.page = (int)page;
+        region.x = x * cell + settings.padding;
+        region.y = y * cell + settings.padding;
+        region.width = image.width;
+        region.height = image.height;
+        region.u0 = (float)region.x / settings.pageSize;
+        region.v0 = (float)region.y / settings.pageSize;
+        region.u1 = (float)(region.x + region.width) / settings.pageSize;
+        region.v1 = (float)(region.y + region.height) / settings.pageSize;
+    }
+    return (int)packers.size();
+}
+
+// pack count images of nrChannels into atlas, copying them in over pool
+// when given; false if an image is too large for a page
+// ----------------------------------------------------------------------------
+inline bool atlasBuild(const AtlasImage* images, int count, int nrChannels, const AtlasSettings& settings,
+                       TextureAtlas& atlas, ThreadPool* pool = NULL)
+{
+    int pageCount = atlasLayout(images, count, settings, atlas.regions);
+    if (count > 0 && pageCount == 0)
+        return false;
+    atlas.pageSize = settings.pageSize;
+    atlas.nrChannels = nrChannels;
+    atlas.pages.assign(pageCount, std::vector<unsigned char>());
+    for (std::vector<unsigned char>& page : atlas.pages)
+        page.assign((size_t)settings.pageSize * settings.pageSize * nrChannels, 0);
+
+    // each image fills its own cell, so images can be copied in parallel:
+    // the image itself, then its edge texels out to the cell's border
+    const int cell = 1 << settings.mipLevels;
+    auto copyImage = [&](int i) {
+        const AtlasImage& image = images[i];
+        const AtlasRegion& region = atlas.regions[i];
+        int cellX = (region.x - settings.padding) / cell * cell, cellY = (region.y - settings.padding) / cell * cell;
+        int cellRight = (region.x + region.width + settings.padding + cell - 1) / cell * cell;
+        int cellBottom = (region.y + region.height + settings.padding + cell - 1) / cell * cell;
+        unsigned char* page = atlas.pages[region.page].data();
+        size_t pitch = (size_t)settings.pageSize * nrChannels;
+        for (int y = cellY; y < cellBottom; y++)
+        {
+            int sourceY = std::min(std::max(y - region.y, 0), image.height - 1);
+            const unsigned char* source = image.pixels + (size_t)sourceY * image.width * nrChannels;
+            unsigned char* row = page + y * pitch;
+            for (int x = cellX; x < region.x; x++)
+                memcpy(row + (size_t)x * nrChannels, source, nrChannels);
+            memcpy(row + (size_t)region.x * nrChannels, source, (size_t)image.width * nrChannels);
+            const unsigned char* last = source + (size_t)(image.width - 1) * nrChannels;
+            for (int x = region.x + image.width; x < cellRight; x++)
+                memcpy(row + (size_t)x * nrChannels, last, nrChannels);
+        }
+    };
+    if (pool && count > 1)
+        pool->parallelFor(count, copyImage);
+    else
+        for (int i = 0; i < count; i++)
+            copyImage(i);
+    return true;
+}
+
+// texels of images over texels of pages, each page counted only down to its
+// lowest image, since pages fill from the top and could be cut off there
+inline double atlasOccupancy(const TextureAtlas& atlas)
+{
+    std::vector<int> rows(atlas.pages.size(), 0);
+    double texels = 0.0;
+    for (const AtlasRegion& region : atlas.regions)
+    {
+        texels += (double)region.width * region.height;
+        rows[region.page] = std::max(rows[region.page], region.y + region.height);
+    }
+    double area = 0.0;
+    for (int used : rows)
+        area += (double)used * atlas.pageSize;
+    return area > 0.0 ? texels / area : 0.0;
+}
+#endif
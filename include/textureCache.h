@@ -0,0 +1,320 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <bakedTexture.h>
+#include <blockCompress.h>
+#include <fastHash.h>
+#include <mappedFile.h>
+#include <mipmap.h>
+
+// On-disk layout of a texture cache entry (see TextureCache), little-endian
+// as written by the host, laid out like a bake (include/bakedTexture.h):
+//
+//   TextureCacheHeader               the level table included
+//   level 0, level 1, ...            at levels[i].offset, levels[i].bytes each
+//
+// Levels hold pixels of bitsPerChannel with tightly packed rows, or blocks
+// of blockFormat - 1 when that is non-zero.
+struct TextureCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t nrChannels;
+    uint32_t bitsPerChannel;
+    uint32_t blockFormat; // 0 = pixels, else BlockFormat + 1
+    uint32_t levelCount;
+    uint32_t reserved;
+    uint64_t key; // TextureCache::key() of what it was decoded from
+    BakedTextureLevel levels[BAKED_TEXTURE_MAX_LEVELS];
+};
+
+static const char TEXTURE_CACHE_MAGIC[8] = { 'T', 'E', 'X', 'C', 'A', 'C', 'H', 'E' };
+static const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+// every setting that changes what a load produces; hashed after the source
+struct TextureCacheSettings
+{
+    uint32_t version;
+    int32_t flipVertically;
+    int32_t desiredChannels;
+    int32_t bitsPerChannel;
+    int32_t unpremultiply;
+    int32_t convertIphonePng;
+    float hdrToLdrGamma, hdrToLdrScale;
+    float ldrToHdrGamma, ldrToHdrScale;
+    int32_t mips; // 0, or 1 + MipFilter
+    int32_t mipSrgb;
+    int32_t blockFormats[2]; // 0, or 1 + BlockFormat, opaque and with alpha
+};
+
+// Decoded textures on local disk, addressed by a hash of the source file's
+// bytes and the settings they were decoded with, so an unchanged asset is
+// never decoded twice, wherever it lives and whatever its mtime says.
+// Entries are mapped rather than read on a hit, and written whole to a
+// temporary file that is renamed into place, so a reader never sees half
+// an entry. The entries together stay under a size cap: past it the least
+// recently used go first, recency being each file's mtime, which a hit
+// bumps. Any number of loader threads may share one cache.
+class TextureCache
+{
+public:
+    struct Stats
+    {
+        int hits = 0;
+        int misses = 0;
+        int stores = 0;
+        int evictions = 0;
+        uint64_t bytes = 0; // in the directory
+    };
+
+    // entries in directory, made if missing, up to capacity bytes of them
+    TextureCache(const std::string& directory, uint64_t capacity)
+        : directory(directory)
+        , capacity(capacity)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if (error)
+            std::cout << "ERROR::TEXTURE_CACHE::NO_DIRECTORY: " << directory << std::endl;
+        // trimmed now too, in case the cap came down since the last run
+        used = trim(counts.evictions);
+    }
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // the key for source bytes decoded with options, then given mips and
+    // block compression if those aren't NULL (see TextureLoader)
+    // ------------------------------------------------------------------------
+    static uint64_t key(const void* source, size_t size, const stbi_decode_options& options, const MipSettings* mips,
+                        const BlockFormat* blockFormats)
+    {
+        TextureCacheSettings settings;
+        memset(&settings, 0, sizeof(settings));
+        settings.version = TEXTURE_CACHE_VERSION;
+        settings.flipVertically = options.flip_vertically;
+        settings.desiredChannels = options.desired_channels;
+        settings.bitsPerChannel = options.bits_per_channel;
+        settings.unpremultiply = options.unpremultiply;
+        settings.convertIphonePng = options.convert_iphone_png_to_rgb;
+        settings.hdrToLdrGamma = options.hdr_to_ldr_gamma;
+        settings.hdrToLdrScale = options.hdr_to_ldr_scale;
+        settings.ldrToHdrGamma = options.ldr_to_hdr_gamma;
+        settings.ldrToHdrScale = options.ldr_to_hdr_scale;
+        if (mips)
+        {
+            settings.mips = 1 + mips->filter;
+            settings.mipSrgb = mips->srgb;
+        }
+        if (blockFormats)
+        {
+            settings.blockFormats[0] = 1 + blockFormats[0];
+            settings.blockFormats[1] = 1 + blockFormats[1];
+        }
+        return fastHash64(&settings, sizeof(settings), fastHash64(source, size));
+    }
+
+    // fill in a header's level offsets, given each level's size, and return
+    // the entry's total size
+    static uint64_t layout(TextureCacheHeader& header)
+    {
+        uint64_t offset = sizeof(header);
+        for (uint32_t i = 0; i < header.levelCount; i++)
+        {
+            BakedTextureLevel& level = header.levels[i];
+            uint64_t alignment = level.bytes >= 4096 ? 4096 : 64;
+            level.offset = (offset + alignment - 1) & ~(alignment - 1);
+            offset = level.offset + level.bytes;
+        }
+        return offset;
+    }
+
+    // map the entry for key, and make it the most recently used; NULL if
+    // there is none (or it is damaged)
+    // ------------------------------------------------------------------------
+    std::shared_ptr<MappedFile> find(uint64_t key, TextureCacheHeader& header)
+    {
+        std::string path = entryPath(key);
+        std::shared_ptr<MappedFile> file;
+        if (MappedFile::isMappable(path))
+        {
+            file = std::make_shared<MappedFile>();
+            if (!file->open(path, true) || file->size() < sizeof(header))
+                file.reset();
+        }
+        if (file)
+        {
+            memcpy(&header, file->data(), sizeof(header));
+            if (!valid(header, key, file->size()))
+                file.reset();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!file)
+        {
+            counts.misses++;
+            return file;
+        }
+        counts.hits++;
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        return file;
+    }
+
+    // write the entry for key: header with each level's size and dimensions
+    // filled in, levels[i] its bytes. Older entries are evicted to keep the
+    // cache under its cap; one bigger than the whole cache isn't stored
+    // ------------------------------------------------------------------------
+    bool store(uint64_t key, TextureCacheHeader header, const unsigned char* const* levels)
+    {
+        memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+        header.version = TEXTURE_CACHE_VERSION;
+        header.key = key;
+        uint64_t size = layout(header);
+        if (size > capacity)
+            return false;
+
+        std::string path = entryPath(key);
+        // two loads of one file may both miss; each writes its own copy
+        std::string tempPath = path + "." + std::to_string(getpid()) + "-" + std::to_string(nextTemp++) + ".tmp";
+        MappedFile file;
+        if (!file.create(tempPath, size))
+            return false;
+        for (uint32_t i = 0; i < header.levelCount; i++)
+            memcpy(file.data() + header.levels[i].offset, levels[i], header.levels[i].bytes);
+        memcpy(file.data(), &header, sizeof(header));
+        file.close();
+        uint64_t replaced = 0;
+        int64_t mtime;
+        if (!MappedFile::fileStamp(path, replaced, mtime))
+            replaced = 0;
+        if (rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            std::cout << "ERROR::TEXTURE_CACHE::WRITE_FAILED: " << path << std::endl;
+            remove(tempPath.c_str());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counts.stores++;
+        used = used + size - std::min(used, replaced);
+        if (used > capacity)
+            used = trim(counts.evictions);
+        return true;
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats result = counts;
+        result.bytes = used;
+        return result;
+    }
+
+    // hit and miss counts, and how full the cache is
+    void printStats()
+    {
+        Stats now = stats();
+        std::printf("Texture cache: %d hits, %d misses, %d stored, %d evicted, %.1f of %.1f MB\n", now.hits,
+                    now.misses, now.stores, now.evictions, now.bytes / (1024.0 * 1024.0),
+                    capacity / (1024.0 * 1024.0));
+    }
+
+private:
+    struct Entry
+    {
+        std::string path;
+        uint64_t size;
+        std::filesystem::file_time_type lastUsed;
+    };
+
+    std::string directory;
+    uint64_t capacity;
+    std::mutex mutex;
+    uint64_t used = 0;
+    Stats counts;
+    std::atomic<int> nextTemp{0};
+
+    std::string entryPath(uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.tex", (unsigned long long)key);
+        return directory + "/" + name;
+    }
+
+    // as bakedTextureValid: every level the size its place in the chain and
+    // the format make it, so what is handed to GL lies within the file
+    static bool valid(const TextureCacheHeader& header, uint64_t key, uint64_t fileSize)
+    {
+        const uint32_t maxDimension = 1 << 24; // stb_image's STBI_MAX_DIMENSIONS
+        if (memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != TEXTURE_CACHE_VERSION || header.key != key || header.levelCount < 1 ||
+            header.levelCount > (uint32_t)BAKED_TEXTURE_MAX_LEVELS || header.nrChannels < 1 ||
+            header.nrChannels > 4 || header.width < 1 || header.width > maxDimension || header.height < 1 ||
+            header.height > maxDimension ||
+            (header.bitsPerChannel != 8 && header.bitsPerChannel != 16 && header.bitsPerChannel != 32) ||
+            header.blockFormat > (uint32_t)BLOCK_BC7 + 1 || (header.blockFormat != 0 && header.bitsPerChannel != 8))
+            return false;
+        for (uint32_t i = 0; i < header.levelCount; i++)
+        {
+            const BakedTextureLevel& level = header.levels[i];
+            uint32_t width = header.width >> i ? header.width >> i : 1;
+            uint32_t height = header.height >> i ? header.height >> i : 1;
+            uint64_t bytes = header.blockFormat != 0
+                                 ? blockCompressedSize((BlockFormat)(header.blockFormat - 1), width, height)
+                                 : (uint64_t)width * height * header.nrChannels * (header.bitsPerChannel / 8);
+            if (level.width != width || level.height != height || level.bytes != bytes ||
+                level.offset < sizeof(header) || level.offset > fileSize || level.bytes > fileSize - level.offset)
+                return false;
+        }
+        return true;
+    }
+
+    // remove the least recently used entries until the rest fit under the
+    // cap, counting them in evicted; returns the bytes left
+    uint64_t trim(int& evicted)
+    {
+        std::vector<Entry> entries;
+        std::error_code error;
+        for (std::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+        {
+            if (it->path().extension() != ".tex")
+                continue;
+            std::error_code statError;
+            uint64_t size = it->file_size(statError);
+            std::filesystem::file_time_type lastUsed = it->last_write_time(statError);
+            if (!statError)
+                entries.push_back({ it->path().string(), size, lastUsed });
+        }
+        uint64_t total = 0;
+        for (const Entry& entry : entries)
+            total += entry.size;
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry& a, const Entry& b) { return a.lastUsed < b.lastUsed; });
+        // a mapped entry stays readable after its file is removed
+        for (size_t i = 0; i < entries.size() && total > capacity; i++)
+        {
+            if (remove(entries[i].path.c_str()) != 0)
+                continue;
+            total -= entries[i].size;
+            evicted++;
+        }
+        return total;
+    }
+};
+#endif
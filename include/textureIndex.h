@@ -0,0 +1,294 @@
+#ifndef TEXTURE_INDEX_H
+#define TEXTURE_INDEX_H
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <mappedFile.h>
+#include <threadPool.h>
+
+// On-disk layout of a texture index (see TextureIndex and tools/texscan.cpp),
+// all little-endian as written by the host:
+//
+//   TextureIndexHeader
+//   TextureIndexEntry entries[entryCount]   sorted by path
+//   char paths[pathBytes]                   NUL-terminated, as scanned
+struct TextureIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entryCount;
+    uint64_t pathBytes;
+};
+
+struct TextureIndexEntry
+{
+    uint64_t fileSize;
+    int64_t mtime; // nanoseconds since the epoch
+    uint32_t width;
+    uint32_t height;
+    uint8_t nrChannels;     // as stored in the file
+    uint8_t bitsPerChannel; // 8, 16, or 32 for HDR
+    uint8_t flags;          // TEXTURE_INDEX_VALID once the header parsed
+    uint8_t reserved;
+    uint32_t pathOffset; // into paths
+};
+
+static const char TEXTURE_INDEX_MAGIC[8] = { 'T', 'E', 'X', 'I', 'N', 'D', 'E', 'X' };
+static const uint32_t TEXTURE_INDEX_VERSION = 1;
+static const uint8_t TEXTURE_INDEX_VALID = 1;
+
+// What every image under an asset directory looks like, from a header probe
+// (stbi_info, stbi_is_16_bit, stbi_is_hdr) rather than a decode, so sizes
+// are known before the GL context exists and the loader can set up GPU
+// storage and staging memory without opening the images again. scan()
+// probes files in parallel and only the ones whose size or mtime changed
+// since the index was loaded; files that fail to probe are remembered too,
+// so they aren't retried until they change.
+class TextureIndex
+{
+public:
+    struct Entry
+    {
+        std::string path; // as found by scan(): directory + relative path
+        uint64_t fileSize = 0;
+        int64_t mtime = 0;
+        int width = 0;
+        int height = 0;
+        int nrChannels = 0;
+        int bitsPerChannel = 8;
+        bool valid = false; // stb_image understood the header
+    };
+
+    struct ScanResult
+    {
+        int files = 0;   // images found
+        int probed = 0;  // new or changed, so read again
+        int removed = 0; // in the index but gone from the directory
+        double ms = 0.0;
+        bool changed() const
+        {
+            return probed > 0 || removed > 0;
+        }
+    };
+
+    // read an index written by save(); false (and an empty index) if there
+    // is none yet or it is unreadable
+    // ------------------------------------------------------------------------
+    bool load(const std::string& indexPath)
+    {
+        entries.clear();
+        if (!MappedFile::isMappable(indexPath))
+            return false;
+        MappedFile file;
+        if (!file.open(indexPath))
+            return false;
+        TextureIndexHeader header;
+        if (file.size() < sizeof(header))
+            return invalid(indexPath);
+        memcpy(&header, file.data(), sizeof(header));
+        uint64_t pathsOffset = sizeof(header) + (uint64_t)header.entryCount * sizeof(TextureIndexEntry);
+        if (memcmp(header.magic, TEXTURE_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != TEXTURE_INDEX_VERSION || pathsOffset + header.pathBytes != file.size())
+            return invalid(indexPath);
+
+        // filled aside, so a bad record further on leaves the index empty
+        const char* paths = (const char*)file.data() + pathsOffset;
+        std::vector<Entry> loaded(header.entryCount);
+        for (uint32_t i = 0; i < header.entryCount; i++)
+        {
+            TextureIndexEntry record;
+            memcpy(&record, file.data() + sizeof(header) + (size_t)i * sizeof(record), sizeof(record));
+            if (record.pathOffset >= header.pathBytes ||
+                !memchr(paths + record.pathOffset, 0, header.pathBytes - record.pathOffset))
+                return invalid(indexPath);
+            Entry& entry = loaded[i];
+            entry.path = paths + record.pathOffset;
+            entry.fileSize = record.fileSize;
+            entry.mtime = record.mtime;
+            entry.width = (int)record.width;
+            entry.height = (int)record.height;
+            entry.nrChannels = record.nrChannels;
+            entry.bitsPerChannel = record.bitsPerChannel;
+            entry.valid = (record.flags & TEXTURE_INDEX_VALID) != 0;
+        }
+        std::sort(loaded.begin(), loaded.end(), byPath);
+        entries.swap(loaded);
+        return true;
+    }
+
+    // write the index, replacing indexPath only once the new one is complete
+    // ------------------------------------------------------------------------
+    bool save(const std::string& indexPath) const
+    {
+        TextureIndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TEXTURE_INDEX_MAGIC, sizeof(header.magic));
+        header.version = TEXTURE_INDEX_VERSION;
+        header.entryCount = (uint32_t)entries.size();
+
+        std::vector<TextureIndexEntry> records(entries.size());
+        std::string paths;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const Entry& entry = entries[i];
+            TextureIndexEntry& record = records[i];
+            memset(&record, 0, sizeof(record));
+            record.fileSize = entry.fileSize;
+            record.mtime = entry.mtime;
+            record.width = (uint32_t)entry.width;
+            record.height = (uint32_t)entry.height;
+            record.nrChannels = (uint8_t)entry.nrChannels;
+            record.bitsPerChannel = (uint8_t)entry.bitsPerChannel;
+            record.flags = entry.valid ? TEXTURE_INDEX_VALID : 0;
+            record.pathOffset = (uint32_t)paths.size();
+            paths.append(entry.path).push_back('\0');
+        }
+        header.pathBytes = paths.size();
+
+        std::string tempPath = indexPath + ".tmp";
+        FILE* file = fopen(tempPath.c_str(), "wb");
+        bool ok = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(records.data(), sizeof(TextureIndexEntry), records.size(), file) == records.size() &&
+                  fwrite(paths.data(), 1, paths.size(), file) == paths.size();
+        if (file && fclose(file) != 0)
+            ok = false;
+        if (!ok || rename(tempPath.c_str(), indexPath.c_str()) != 0)
+        {
+            std::cout << "ERROR::TEXTURE_INDEX::SAVE_FAILED: " << indexPath << std::endl;
+            remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // bring the index up to date with the images under directory: probe the
+    // new and changed ones over pool, drop the ones that are gone
+    // ------------------------------------------------------------------------
+    ScanResult scan(const std::string& directory, ThreadPool& pool)
+    {
+        ScanResult result;
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<Entry> found;
+        std::error_code error;
+        namespace fs = std::filesystem;
+        fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, error), end;
+        if (error)
+            std::cout << "ERROR::TEXTURE_INDEX::SCAN_FAILED: " << directory << " (" << error.message() << ")"
+                      << std::endl;
+        for (; !error && it != end; it.increment(error))
+        {
+            Entry entry;
+            entry.path = it->path().generic_string();
+            if (isImage(entry.path) && MappedFile::fileStamp(entry.path, entry.fileSize, entry.mtime))
+                found.push_back(entry);
+        }
+        std::sort(found.begin(), found.end(), byPath);
+
+        // carry over what hasn't changed; everything else gets probed
+        std::vector<int> stale;
+        for (size_t i = 0; i < found.size(); i++)
+        {
+            const Entry* old = find(found[i].path);
+            if (old && old->fileSize == found[i].fileSize && old->mtime == found[i].mtime)
+                found[i] = *old;
+            else
+                stale.push_back((int)i);
+        }
+        for (const Entry& entry : entries)
+            if (!std::binary_search(found.begin(), found.end(), entry, byPath))
+                result.removed++;
+
+        pool.parallelFor((int)stale.size(), [&](int i) { probe(found[stale[i]]); });
+
+        entries.swap(found);
+        result.files = (int)entries.size();
+        result.probed = (int)stale.size();
+        result.ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    // the entry for path as scan() spelled it, or NULL
+    const Entry* find(const std::string& path) const
+    {
+        Entry key;
+        key.path = path;
+        auto it = std::lower_bound(entries.begin(), entries.end(), key, byPath);
+        return it != entries.end() && it->path == path ? &*it : NULL;
+    }
+
+    const std::vector<Entry>& all() const
+    {
+        return entries;
+    }
+
+private:
+    std::vector<Entry> entries; // sorted by path
+
+    static bool byPath(const Entry& a, const Entry& b)
+    {
+        return a.path < b.path;
+    }
+
+    static bool invalid(const std::string& indexPath)
+    {
+        std::cout << "ERROR::TEXTURE_INDEX::INVALID: " << indexPath << std::endl;
+        return false;
+    }
+
+    // extensions stb_image can read
+    static bool isImage(const std::string& path)
+    {
+        static const char* extensions[] = { "png", "jpg", "jpeg", "bmp", "tga", "gif", "psd",
+                                            "hdr", "pic", "pnm", "ppm", "pgm" };
+        size_t dot = path.rfind('.');
+        if (dot == std::string::npos)
+            return false;
+        std::string extension = path.substr(dot + 1);
+        for (char& c : extension)
+            c = (char)tolower((unsigned char)c);
+        for (const char* known : extensions)
+            if (extension == known)
+                return true;
+        return false;
+    }
+
+    // header-only probe: mapping the file means only the pages holding the
+    // header are read; runs on the pool
+    static void probe(Entry& entry)
+    {
+        int width = 0, height = 0, nrChannels = 0, is16 = 0, isHdr = 0;
+        MappedFile file;
+        if (MappedFile::isMappable(entry.path) && file.open(entry.path))
+        {
+            int len = (int)std::min(file.size(), (size_t)INT32_MAX);
+            entry.valid = stbi_info_from_memory(file.data(), len, &width, &height, &nrChannels) != 0;
+            is16 = stbi_is_16_bit_from_memory(file.data(), len);
+            isHdr = stbi_is_hdr_from_memory(file.data(), len);
+        }
+        else
+        {
+            entry.valid = stbi_info(entry.path.c_str(), &width, &height, &nrChannels) != 0;
+            is16 = stbi_is_16_bit(entry.path.c_str());
+            isHdr = stbi_is_hdr(entry.path.c_str());
+        }
+        entry.width = entry.valid ? width : 0;
+        entry.height = entry.valid ? height : 0;
+        entry.nrChannels = entry.valid ? nrChannels : 0;
+        entry.bitsPerChannel = isHdr ? 32 : is16 ? 16 : 8;
+    }
+};
+#endif
@@ -0,0 +1,550 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include "stb_image.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <bakedTexture.h>
+#include <blockCompress.h>
+#include <mappedFile.h>
+#include <mipmap.h>
+#include <textureCache.h>
+#include <threadPool.h>
+
+// Decodes image files on a ThreadPool so startup pays for the slowest
+// texture rather than the sum of all of them. load() queues a file and
+// returns at once; the GL thread then calls next() to take decoded images in
+// the order they finish and uploads them itself, since only that thread may
+// touch the context. Images are decoded straight into staging buffers that
+// recycle() hands back for later loads, and each worker keeps an stbi_arena
+// for the decoder's scratch memory, so a batch doesn't allocate and free a
+// full image and its tables per texture. Every decode is timed, with its
+// peak memory, for printTimings(). Files are memory-mapped and decoded in
+// place, with a read-ahead hint; pipes and anything else that can't be
+// mapped are read through a buffer instead. A current bake of the file (see
+// tools/texbake.cpp), with its mips filtered as setGenerateMips() asks if it
+// does, is used in its place: no decode, and the image comes with its whole
+// mip chain. setGenerateMips() has decoded images come with
+// one too, built on the pool (include/mipmap.h) rather than by the driver,
+// and setBlockCompression() has the levels come as BC1/BC3/BC7 blocks for
+// glCompressedTexImage2D (include/blockCompress.h). With setCache(), what
+// comes out of all that is kept in a TextureCache and mapped back on later
+// loads of the same bytes with the same settings, without stb_image.
+class TextureLoader
+{
+public:
+    // a decoded image; pixels point into storage, which the caller owns and
+    // may give back with recycle() once it has been uploaded. A baked or
+    // cached image instead points into its mapped file. Any of the three may
+    // come with every mip level. Compressed images hold blocks of blockFormat
+    // in place of pixels, for every level they have
+    struct Image
+    {
+        struct Level
+        {
+            int width;
+            int height;
+            const unsigned char* pixels;
+            size_t bytes;
+        };
+
+        int id = -1; // as returned by load()
+        std::string path;
+        int width = 0;
+        int height = 0;
+        int nrChannels = 0;     // channels in pixels, after any desired_channels
+        int bitsPerChannel = 8; // stbi_uc, stbi_us or float pixels
+        void* pixels = NULL;
+        std::vector<unsigned char> storage;
+        std::vector<Level> levels;           // mip chain, level 0 first; empty without mips
+        std::shared_ptr<MappedFile> mapping; // keeps baked or cached levels mapped
+        bool cached = false;                 // came from the TextureCache
+        bool blockCompressed = false;
+        BlockFormat blockFormat = BLOCK_BC1;
+        double decodeMs = 0.0;
+        size_t peakBytes = 0; // most decoder memory in use at once, besides storage
+        std::string error; // stbi_failure_reason() when pixels is NULL
+    };
+
+    TextureLoader(ThreadPool& pool)
+        : pool(pool)
+    {
+    }
+    ~TextureLoader()
+    {
+        // workers still hold a pointer to this loader until they report back
+        std::unique_lock<std::mutex> lock(mutex);
+        imageReady.wait(lock, [this] { return outstanding == 0; });
+    }
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    // map files (the default) or always read them into a buffer; applies to
+    // the load() calls that follow
+    void setMapFiles(bool enable)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        mapFiles = enable;
+    }
+
+    // build the mip chain of decoded images on the CPU (off by default);
+    // applies to the load() calls that follow
+    void setGenerateMips(bool enable, const MipSettings& settings = MipSettings())
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generateMips = enable;
+        mipSettings = settings;
+    }
+
+    // block-compress 8-bit images once decoded (off by default), in opaque
+    // or, for images with an alpha channel, withAlpha; images without a mip
+    // chain come as level 0 alone. Applies to the load() calls that follow
+    void setBlockCompression(bool enable, BlockFormat opaque = BLOCK_BC1, BlockFormat withAlpha = BLOCK_BC3)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        compressBlocks = enable;
+        blockFormats[0] = opaque;
+        blockFormats[1] = withAlpha;
+    }
+
+    // look up decodes in cache first and store them there after, or not
+    // with NULL (the default); applies to the load() calls that follow
+    void setCache(TextureCache* cache)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->cache = cache;
+    }
+
+    // queue a decode; flip stores rows bottom-up the way OpenGL expects, and
+    // desiredChannels 0 keeps the file's channels
+    // ------------------------------------------------------------------------
+    int load(const std::string& path, bool flip = false, int desiredChannels = 0)
+    {
+        stbi_decode_options options;
+        stbi_decode_options_init(&options);
+        options.flip_vertically = flip;
+        options.desired_channels = desiredChannels;
+        return load(path, options);
+    }
+
+    // queue a decode with full control over the stb_image settings; they
+    // travel with the request, so loads never see each other's options
+    // ------------------------------------------------------------------------
+    int load(const std::string& path, const stbi_decode_options& options)
+    {
+        int id;
+        bool map, mips, compress;
+        MipSettings mipSettings;
+        BlockFormat formats[2];
+        TextureCache* cache;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (outstanding == 0 && done.empty())
+                batchStart = std::chrono::steady_clock::now();
+            id = nextId++;
+            outstanding++;
+            map = mapFiles;
+            mips = generateMips;
+            mipSettings = this->mipSettings;
+            compress = compressBlocks;
+            formats[0] = blockFormats[0];
+            formats[1] = blockFormats[1];
+            cache = this->cache;
+        }
+        pool.submit([this, id, path, options, map, mips, mipSettings, compress, formats, cache] {
+            decode(id, path, options, map, mips ? &mipSettings : NULL, compress ? formats : NULL, cache);
+        });
+        return id;
+    }
+
+    // hand over the next decoded image, in completion order; blocks only if
+    // wait is set and a decode is still running. Returns false when nothing
+    // (more) is ready, or with wait set, once every load() has been handed out
+    // ------------------------------------------------------------------------
+    bool next(Image& out, bool wait = false)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait)
+            imageReady.wait(lock, [this] { return !done.empty() || outstanding == 0; });
+        if (done.empty())
+            return false;
+        out = std::move(done.front());
+        done.pop_front();
+        return true;
+    }
+
+    // keep an image's memory for the decodes still to come; image is emptied
+    // ------------------------------------------------------------------------
+    void recycle(Image& image)
+    {
+        image.pixels = NULL;
+        image.levels.clear();
+        image.blockCompressed = false;
+        image.cached = false;
+        image.mapping.reset();
+        if (image.storage.empty())
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        staging.push_back(std::move(image.storage));
+        image.storage.clear();
+    }
+
+    // the whole file through stdio, in chunks since pipes can't tell their
+    // size up front; the fallback for files that can't be mapped
+    // ------------------------------------------------------------------------
+    static bool readFile(const std::string& path, std::vector<unsigned char>& data)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        size_t used = 0;
+        data.resize(1 << 16);
+        for (;;)
+        {
+            used += fread(data.data() + used, 1, data.size() - used, file);
+            if (used < data.size())
+                break;
+            data.resize(data.size() * 2);
+        }
+        if (ferror(file))
+            used = 0;
+        data.resize(used);
+        fclose(file);
+        return !data.empty();
+    }
+
+    // set aside staging memory for a decode of this many bytes ahead of
+    // time, e.g. sized from a TextureIndex, so the first loads don't
+    // allocate either
+    // ------------------------------------------------------------------------
+    void reserveStaging(size_t bytes)
+    {
+        std::vector<unsigned char> buffer(bytes);
+        std::lock_guard<std::mutex> lock(mutex);
+        staging.push_back(std::move(buffer));
+    }
+
+    // loads not yet handed out by next()
+    int pending()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return outstanding + (int)done.size();
+    }
+
+    // per-asset decode times, and wall time against their sum for the batch
+    void printTimings()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        double sumMs = 0.0;
+        for (const Timing& timing : timings)
+        {
+            std::printf("  %-40s %5dx%-5d %8.2f ms %8.1f MB peak%s\n", timing.path.c_str(), timing.width,
+                        timing.height, timing.decodeMs, timing.peakBytes / (1024.0 * 1024.0),
+                        timing.cached ? "  (cached)" : "");
+            sumMs += timing.decodeMs;
+        }
+        std::printf("Decoded %d textures in %.2f ms (%.2f ms if serial) on %d workers\n", (int)timings.size(),
+                    wallMs, sumMs, pool.size());
+    }
+
+private:
+    struct Timing
+    {
+        std::string path;
+        int width;
+        int height;
+        double decodeMs;
+        size_t peakBytes;
+        bool cached;
+    };
+
+    // scratch memory for the decodes on one worker thread
+    struct Arena
+    {
+        stbi_arena arena;
+        Arena() { stbi_arena_init(&arena, NULL, 0); }
+        ~Arena() { stbi_arena_free(&arena); }
+    };
+
+    ThreadPool& pool;
+    std::mutex mutex;
+    std::condition_variable imageReady;
+    std::deque<Image> done;
+    std::vector<Timing> timings;
+    std::vector<std::vector<unsigned char>> staging; // recycled image memory
+    int nextId = 0;
+    int outstanding = 0;
+    bool mapFiles = true;
+    bool generateMips = false;
+    MipSettings mipSettings;
+    bool compressBlocks = false;
+    BlockFormat blockFormats[2] = { BLOCK_BC1, BLOCK_BC3 };
+    TextureCache* cache = NULL;
+    std::chrono::steady_clock::time_point batchStart;
+    double wallMs = 0.0;
+
+    // the smallest recycled buffer of at least size bytes, else the most
+    // recently recycled one grown to size
+    std::vector<unsigned char> takeStaging(size_t size)
+    {
+        std::vector<unsigned char> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int best = -1;
+            for (int i = 0; i < (int)staging.size(); i++)
+                if (staging[i].size() >= size && (best < 0 || staging[i].size() < staging[best].size()))
+                    best = i;
+            if (best < 0)
+                best = (int)staging.size() - 1;
+            if (best >= 0)
+            {
+                buffer = std::move(staging[best]);
+                staging.erase(staging.begin() + best);
+            }
+        }
+        if (buffer.size() < size)
+            buffer.resize(size);
+        return buffer;
+    }
+
+    // map a current bake of path made with the same flip and channels, and
+    // if mips is given, with its mips too; the image's levels point into the
+    // mapping, which it keeps open
+    static bool loadBaked(const std::string& path, const stbi_decode_options& options, const MipSettings* mips,
+                          Image& image)
+    {
+        std::string bakedPath = bakedTexturePath(path);
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        if (!MappedFile::isMappable(bakedPath) || !MappedFile::fileStamp(path, sourceSize, sourceMtime))
+            return false;
+        std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+        BakedTextureHeader header;
+        if (!file->open(bakedPath, true) || file->size() < sizeof(header))
+            return false;
+        memcpy(&header, file->data(), sizeof(header));
+        if (!bakedTextureValid(header, file->size()) ||
+            !bakedTextureCurrent(header, sourceSize, sourceMtime, options.flip_vertically != 0,
+                                 options.desired_channels) ||
+            (mips && (header.flags & (BAKED_TEXTURE_SRGB_MIPS | BAKED_TEXTURE_KAISER_MIPS)) !=
+                         bakedTextureMipFlags(*mips)))
+            return false;
+        for (uint32_t i = 0; i < header.levelCount; i++)
+            image.levels.push_back({ (int)header.levels[i].width, (int)header.levels[i].height,
+                                     bakedTextureLevel(file->data(), header, i), (size_t)header.levels[i].bytes });
+        image.width = (int)header.width;
+        image.height = (int)header.height;
+        image.nrChannels = (int)header.nrChannels;
+        image.pixels = (void*)image.levels[0].pixels;
+        image.mapping = file;
+        return true;
+    }
+
+    // map the cache entry for key into image, levels and all
+    static bool loadCached(TextureCache& cache, uint64_t key, Image& image)
+    {
+        TextureCacheHeader header;
+        std::shared_ptr<MappedFile> file = cache.find(key, header);
+        if (!file)
+            return false;
+        for (uint32_t i = 0; i < header.levelCount; i++)
+            image.levels.push_back({ (int)header.levels[i].width, (int)header.levels[i].height,
+                                     file->data() + header.levels[i].offset, (size_t)header.levels[i].bytes });
+        image.width = (int)header.width;
+        image.height = (int)header.height;
+        image.nrChannels = (int)header.nrChannels;
+        image.bitsPerChannel = (int)header.bitsPerChannel;
+        image.blockCompressed = header.blockFormat != 0;
+        image.blockFormat = image.blockCompressed ? (BlockFormat)(header.blockFormat - 1) : BLOCK_BC1;
+        image.pixels = (void*)image.levels[0].pixels;
+        // a lone level of pixels is an image that came without mips
+        if (header.levelCount == 1 && !image.blockCompressed)
+            image.levels.clear();
+        image.mapping = file;
+        image.cached = true;
+        return true;
+    }
+
+    // and the other way: every level image has, or the pixels alone
+    static void storeCached(TextureCache& cache, uint64_t key, const Image& image)
+    {
+        std::vector<Image::Level> levels = image.levels;
+        if (levels.empty())
+            levels.push_back({ image.width, image.height, (const unsigned char*)image.pixels,
+                               (size_t)image.width * image.height * image.nrChannels * (image.bitsPerChannel / 8) });
+        TextureCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        header.width = image.width;
+        header.height = image.height;
+        header.nrChannels = image.nrChannels;
+        header.bitsPerChannel = image.bitsPerChannel;
+        header.blockFormat = image.blockCompressed ? 1 + image.blockFormat : 0;
+        header.levelCount = (uint32_t)levels.size();
+        std::vector<const unsigned char*> data;
+        for (uint32_t i = 0; i < header.levelCount; i++)
+        {
+            header.levels[i].width = levels[i].width;
+            header.levels[i].height = levels[i].height;
+            header.levels[i].bytes = levels[i].bytes;
+            data.push_back(levels[i].pixels);
+        }
+        cache.store(key, header, data.data());
+    }
+
+    // the rest of the chain after level 0 in storage, level after level
+    void buildMips(Image& image, int nrChannels, int bitsPerChannel, const MipSettings& settings)
+    {
+        int levelCount = mipLevelCount(image.width, image.height);
+        std::vector<void*> levels(levelCount);
+        size_t offset = 0;
+        for (int i = 0; i < levelCount; i++)
+        {
+            int width = mipLevelSize(image.width, i), height = mipLevelSize(image.height, i);
+            size_t bytes = (size_t)width * height * nrChannels * (bitsPerChannel / 8);
+            levels[i] = image.storage.data() + offset;
+            image.levels.push_back({ width, height, image.storage.data() + offset, bytes });
+            offset += bytes;
+        }
+        mipGenerate(levels.data(), levelCount, image.width, image.height, nrChannels, bitsPerChannel, settings,
+                    &pool);
+    }
+
+    // every level of an 8-bit image as blocks in new storage, over the pool;
+    // the decoded pixels go back to staging and a bake is let go
+    void compressLevels(Image& image, BlockFormat format)
+    {
+        if (image.levels.empty())
+            image.levels.push_back({ image.width, image.height, (const unsigned char*)image.pixels,
+                                     (size_t)image.width * image.height * image.nrChannels });
+        size_t total = 0;
+        for (const Image::Level& level : image.levels)
+            total += blockCompressedSize(format, level.width, level.height);
+        std::vector<unsigned char> blocks = takeStaging(total);
+        size_t offset = 0;
+        for (Image::Level& level : image.levels)
+        {
+            blockCompress(level.pixels, level.width, level.height, image.nrChannels, format, blocks.data() + offset,
+                          &pool);
+            level.pixels = blocks.data() + offset;
+            level.bytes = blockCompressedSize(format, level.width, level.height);
+            offset += level.bytes;
+        }
+        if (!image.storage.empty())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            staging.push_back(std::move(image.storage));
+        }
+        image.storage = std::move(blocks);
+        image.mapping.reset();
+        image.pixels = image.storage.data();
+        image.blockCompressed = true;
+        image.blockFormat = format;
+    }
+
+    // runs on a worker thread; mips is NULL unless the chain is wanted,
+    // blockFormats (opaque, with alpha) NULL unless it is to be compressed,
+    // and cache NULL unless the result is to be looked up and kept there
+    void decode(int id, const std::string& path, const stbi_decode_options& requested, bool map,
+                const MipSettings* mips, const BlockFormat* blockFormats, TextureCache* cache)
+    {
+        static thread_local Arena scratch;
+        stbi_decode_stats stats = {};
+        stbi_decode_options options = requested;
+        if (!options.arena)
+            options.arena = &scratch.arena;
+        if (!options.stats)
+            options.stats = &stats;
+
+        Image image;
+        image.id = id;
+        image.path = path;
+        image.bitsPerChannel = options.bits_per_channel;
+
+        auto start = std::chrono::steady_clock::now();
+        int fileChannels = 0;
+        // decode from memory: only then can stb_image split a JPEG scan over
+        // the stbi_set_parallel() pool. The header gives the size, so the
+        // pixels go straight into a staging buffer
+        MappedFile mapped;
+        std::vector<unsigned char> buffered;
+        const unsigned char* bytes = NULL;
+        int size = 0;
+        bool baked = options.bits_per_channel == 8 && loadBaked(path, options, mips, image);
+        if (baked)
+            fileChannels = image.nrChannels;
+        else if (map && MappedFile::isMappable(path) && mapped.open(path, true))
+        {
+            bytes = mapped.data();
+            size = (int)mapped.size();
+        }
+        else if (readFile(path, buffered))
+        {
+            bytes = buffered.data();
+            size = (int)buffered.size();
+        }
+        // the source bytes are hashed either way, so a cache hit costs a read
+        // of the file but no decode
+        uint64_t cacheKey = 0;
+        bool cached = false;
+        if (!baked && bytes && cache)
+        {
+            cacheKey = TextureCache::key(bytes, (size_t)size, options, mips, blockFormats);
+            cached = loadCached(*cache, cacheKey, image);
+            if (cached)
+                fileChannels = image.nrChannels;
+        }
+        if (!baked && !cached && bytes &&
+            stbi_info_from_memory(bytes, size, &image.width, &image.height, &fileChannels))
+        {
+            int channels = options.desired_channels ? options.desired_channels : fileChannels;
+            size_t needed = mips ? mipChainSize(image.width, image.height, channels, options.bits_per_channel)
+                                 : stbi_decoded_size(image.width, image.height, fileChannels, &options);
+            image.storage = takeStaging(needed);
+            if (stbi_load_into_from_memory(bytes, size, image.storage.data(), image.storage.size(), &image.width,
+                                           &image.height, &fileChannels, &options))
+            {
+                image.pixels = image.storage.data();
+                if (mips)
+                    buildMips(image, channels, options.bits_per_channel, *mips);
+            }
+            else
+            {
+                recycle(image);
+            }
+        }
+        image.nrChannels = options.desired_channels ? options.desired_channels : fileChannels;
+        if (image.pixels && blockFormats && image.bitsPerChannel == 8 && !image.blockCompressed)
+            compressLevels(image, blockFormats[image.nrChannels == 2 || image.nrChannels == 4]);
+        if (image.pixels && cache && !baked && !cached)
+            storeCached(*cache, cacheKey, image);
+        auto finish = std::chrono::steady_clock::now();
+        image.decodeMs = std::chrono::duration<double, std::milli>(finish - start).count();
+        image.peakBytes = options.stats->peak_bytes;
+        if (!image.pixels)
+        {
+            image.error = bytes ? stbi_failure_reason() : "can't read file";
+            std::cout << "ERROR::TEXTURE_LOADER::DECODE_FAILED: " << path << " (" << image.error << ")" << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            timings.push_back({ path, image.width, image.height, image.decodeMs, image.peakBytes, image.cached });
+            done.push_back(std::move(image));
+            if (--outstanding == 0)
+                wallMs = std::chrono::duration<double, std::milli>(finish - batchStart).count();
+            // notify under the lock: the destructor may run as soon as it is released
+            imageReady.notify_all();
+        }
+    }
+};
+#endif
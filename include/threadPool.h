@@ -0,0 +1,126 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for CPU-heavy image work. submit() queues a
+// fire-and-forget task; parallelFor() splits an index range over the workers
+// and the calling thread, and is safe to call from inside another task
+// because the caller keeps taking indices itself until the range is done.
+class ThreadPool
+{
+public:
+    // nrThreads <= 0 picks one worker per hardware thread minus the caller
+    ThreadPool(int nrThreads = 0)
+    {
+        if (nrThreads <= 0)
+            nrThreads = (int)std::thread::hardware_concurrency() - 1;
+        if (nrThreads < 1)
+            nrThreads = 1;
+        for (int i = 0; i < nrThreads; i++)
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const
+    {
+        return (int)workers.size();
+    }
+
+    // ------------------------------------------------------------------------
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        taskAvailable.notify_one();
+    }
+
+    // run job(i) for every i in [0, count) and return when all are done
+    // ------------------------------------------------------------------------
+    void parallelFor(int count, const std::function<void(int)>& job)
+    {
+        if (count <= 0)
+            return;
+        if (count == 1)
+        {
+            job(0);
+            return;
+        }
+
+        struct Range
+        {
+            std::atomic<int> next{0};
+            std::atomic<int> done{0};
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        std::shared_ptr<Range> range = std::make_shared<Range>();
+
+        // helpers hold their own reference: one may only get to run after
+        // the caller has already finished the whole range and returned
+        auto work = [range, count, &job]() {
+            int i;
+            while ((i = range->next++) < count)
+            {
+                job(i);
+                if (++range->done == count)
+                {
+                    std::lock_guard<std::mutex> lock(range->mutex);
+                    range->finished.notify_all();
+                }
+            }
+        };
+        int helpers = count - 1 < size() ? count - 1 : size();
+        for (int h = 0; h < helpers; h++)
+            submit(work);
+        work();
+
+        std::unique_lock<std::mutex> lock(range->mutex);
+        range->finished.wait(lock, [&] { return range->done == count; });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                taskAvailable.wait(lock, [this] { return !tasks.empty() || stopping; });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+#endif
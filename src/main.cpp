@@ -14,50 +14,97 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
 #include <ctime>
 
 #include <colorDef.h>
 #include <shader.h>
-
+#include <threadPool.h>
+#include <pboReadback.h>
+#include <captureQueue.h>
+#include <captureController.h>
+#include <frameRecorder.h>
+#include <textureLoader.h>
+#include <textureIndex.h>
+#include <textureCache.h>
+#include <blockCompress.h>
+
+// S3TC and BPTC formats, which a core profile loader may leave out
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
 
 // change this as needed
 char *filepath = "/Users/matthewbach/Desktop/Code/OpenGL/captures/";
 
+// in-flight screenshots, written out a few frames after C is pressed
+PboReadback captureRing;
+// finished readbacks waiting for (or being encoded by) the worker threads
+CaptureQueue captureQueue(2, 4, CaptureQueue::DROP_OLDEST);
+// one capture per press of C, named <date>_<sequence>.png, repeats skipped
+CaptureController captureController(filepath, captureRing, captureQueue);
+// R starts/stops streaming every frame into a raw <date>_<time>.frames file
+FrameRecorder frameRecorder;
+const int recordMaxFrames = 1800; // 30 seconds at 60 fps
+// image sizes of everything under src/resources, kept between runs
+const char* textureIndexPath = "src/resources/.texindex";
+// decoded, mipmapped and compressed textures from earlier runs
+const char* textureCachePath = "src/resources/.texcache";
+const uint64_t textureCacheBytes = 256ull << 20;
+
 
 // prototypes
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);  
-void processInput(GLFWwindow *window, const char* filepath, float* mix_add, float* translation_vec3);
-void saveImage(const char* filepath, GLFWwindow* w);
-
+void processInput(GLFWwindow *window, float* mix_add, float* translation_vec3);
+void parallelForPool(void* pool, stbi_write_job_func* job, void* context, int count);
+void readPixelsSync(std::vector<char>& buffer, int* width, int* height, int* stride);
+void reportFrameTimes(const char* label, std::vector<double>& times);
+std::string recordingPath();
+bool hasExtension(const char* name);
+GLenum compressedFormat(BlockFormat format);
 
 
 
-int main() {
-    // Create filepath based on date
-    time_t now = time(0);
-    tm* localTime = localtime(&now);
+int main(int argc, char** argv) {
+    // "main1 --capture-bench [frames]" renders headless and compares the
+    // frame time of synchronous glReadPixels against the PBO readback ring
+    int benchFrames = 0;
+    if (argc > 1 && std::string(argv[1]) == "--capture-bench")
+        benchFrames = (argc > 2) ? std::max(atoi(argv[2]), 1) : 300;
 
-    int yearI = localTime->tm_year + 1900; // Years since 1900
-    int monthI = localTime->tm_mon + 1;    // Months are 0-indexed
-    int dayI = localTime->tm_mday;
 
-    std::string yearS, monthS, dayS;
-    yearS = std::to_string(yearI);
-    monthS = std::to_string(monthI);
-    dayS = std::to_string(dayI);
-    
-    std::string pathS(filepath);
-    pathS += (yearS + "_" + monthS + "_" + dayS + ".png");
-    const char* updated_filepath = pathS.c_str();
+    // TEXTURE INDEX: probe image headers before the window exists; only
+    // images changed since the last run are read again
+    ThreadPool imagePool;
+    TextureIndex textureIndex;
+    textureIndex.load(textureIndexPath);
+    if (textureIndex.scan("src/resources", imagePool).changed())
+        textureIndex.save(textureIndexPath);
 
 
     // CONFIGURATION OF GLFW 
+    if (benchFrames > 0)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL); // no display needed
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     //mac specific
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    if (benchFrames > 0)
+    {
+        // software context (Mesa llvmpipe through OSMesa)
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
 
 
     // WINDOW OBJECT CREATION WITH GLFW
@@ -80,6 +127,8 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    if (benchFrames > 0)
+        glfwSwapInterval(0);
 
     
     // SHADER SETUP
@@ -152,31 +201,102 @@ int main() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // load and generate
-    int width1, width2, height1, height2, nrChannels1, nrChannels2;
-    unsigned char *data1 = stbi_load("src/resources/container.jpg", &width1, &height1, &nrChannels1, 0);
-    
-    stbi_set_flip_vertically_on_load(true);  
-    unsigned char *data2 = stbi_load("src/resources/awesomeface.png", &width2, &height2, &nrChannels2, 0);
-    
-    if (data1 && data2)
+    // load and generate: both files decode at once on the image pool and are
+    // uploaded here, on the GL thread, in whichever order they finish
+    // large JPEGs also split their restart intervals and color conversion
+    stbi_set_parallel(parallelForPool, &imagePool, imagePool.size() + 1);
+    TextureLoader textureLoader(imagePool);
+    // after the first run the textures come from here, without stb_image
+    TextureCache textureCache(textureCachePath, textureCacheBytes);
+    textureLoader.setCache(&textureCache);
+    // mips from the CPU look the same on every driver; the textures hold
+    // sRGB colour, so filter them in linear light
+    MipSettings mipSettings;
+    mipSettings.srgb = true;
+    textureLoader.setGenerateMips(true, mipSettings);
+    // BC1 takes a sixth of the VRAM and bandwidth of GL_RGB; both textures
+    // are drawn without alpha, so neither needs BC3
+    bool compressTextures = hasExtension("GL_EXT_texture_compression_s3tc");
+    if (compressTextures)
+        textureLoader.setBlockCompression(true, BLOCK_BC1, BLOCK_BC1);
+    const char* texturePaths[] = { "src/resources/container.jpg", "src/resources/awesomeface.png" };
+    unsigned int textures[] = { texture1, texture2 };
+    GLint textureFormat = compressTextures ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB;
+    GLint internalFormats[] = { textureFormat, textureFormat };
+    // the index already knows the sizes: set up GPU storage and staging
+    // memory while the images decode, so the uploads only copy
+    int allocatedWidths[] = { 0, 0 }, allocatedHeights[] = { 0, 0 };
+    for (int i = 0; i < 2; i++)
     {
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width1, height1, 0, GL_RGB, GL_UNSIGNED_BYTE, data1);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glBindTexture(GL_TEXTURE_2D, texture2);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width2, height2, 0, GL_RGBA, GL_UNSIGNED_BYTE, data2);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        const TextureIndex::Entry* entry = textureIndex.find(texturePaths[i]);
+        if (!entry || !entry->valid)
+            continue;
+        textureLoader.reserveStaging(mipChainSize(entry->width, entry->height, entry->nrChannels, 8));
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        if (compressTextures)
+            glCompressedTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], entry->width, entry->height, 0,
+                                   (GLsizei)blockCompressedSize(BLOCK_BC1, entry->width, entry->height), NULL);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], entry->width, entry->height, 0, GL_RGB,
+                         GL_UNSIGNED_BYTE, NULL);
+        allocatedWidths[i] = entry->width;
+        allocatedHeights[i] = entry->height;
     }
-    else
+    textureLoader.load(texturePaths[0]);
+    textureLoader.load(texturePaths[1], true);
+
+    // rows are tightly packed, which RGB levels narrower than 4 pixels aren't
+    // by the default alignment
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    TextureLoader::Image image;
+    while (textureLoader.next(image, true))
     {
-        std::cout << "Failed to load textures" << std::endl;
+        if (image.pixels && image.blockCompressed)
+        {
+            GLenum format = compressedFormat(image.blockFormat);
+            glBindTexture(GL_TEXTURE_2D, textures[image.id]);
+            for (size_t level = 0; level < image.levels.size(); level++)
+            {
+                const TextureLoader::Image::Level& mip = image.levels[level];
+                if (level == 0 && image.width == allocatedWidths[image.id] &&
+                    image.height == allocatedHeights[image.id] && (GLint)format == internalFormats[image.id])
+                    glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mip.width, mip.height, format,
+                                              (GLsizei)mip.bytes, mip.pixels);
+                else
+                    glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, format, mip.width, mip.height, 0,
+                                           (GLsizei)mip.bytes, mip.pixels);
+            }
+            // the driver can't build mips of a compressed texture
+            if (image.levels.size() == 1)
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        }
+        else if (image.pixels)
+        {
+            GLenum format = image.nrChannels == 4 ? GL_RGBA : GL_RGB;
+            GLenum type = image.bitsPerChannel == 32 ? GL_FLOAT
+                        : image.bitsPerChannel == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+            glBindTexture(GL_TEXTURE_2D, textures[image.id]);
+            if (image.width == allocatedWidths[image.id] && image.height == allocatedHeights[image.id])
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, format, type, image.pixels);
+            else // changed since the index was written
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[image.id], image.width, image.height, 0, format,
+                             type, image.pixels);
+            // the loader or a bake (tools/texbake.cpp) brings the mip chain
+            for (size_t level = 1; level < image.levels.size(); level++)
+                glTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormats[image.id], image.levels[level].width,
+                             image.levels[level].height, 0, format, type, image.levels[level].pixels);
+            if (image.levels.empty())
+                glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        else
+        {
+            std::cout << "Failed to load textures" << std::endl;
+        }
+        // uploaded; later loads can reuse the memory
+        textureLoader.recycle(image);
     }
-    // free
-
-    stbi_image_free(data1);
-    stbi_image_free(data2);
+    textureLoader.printTimings();
+    textureCache.printStats();
 
     
     ourShader.use();
@@ -184,17 +304,31 @@ int main() {
     ourShader.setInt("texture1", 0);
     ourShader.setInt("texture2", 1);
     
+    // OpenGL returns rows bottom-up; set once, before any encoder thread runs
+    stbi_flip_vertically_on_write(true);
+    // large PNGs are filtered and deflated in row bands across the cores
+    stbi_write_set_parallel(parallelForPool, &imagePool, imagePool.size() + 1);
+
     // input state variables
     float mix_add = 0.0;
     glm::vec3 trans_vec = glm::vec3(0.0f, 0.0f, 0.0f);
 
+    // capture benchmark state: one run of benchFrames per capture path
+    int benchFrame = 0;
+    std::vector<double> benchTimes[3];
+    std::vector<char> benchBuffer;
+    PboReadback::Frame benchCapture;
+
 
 
     // RENDER LOOP
     while(!glfwWindowShouldClose(window)) 
     {
+        double frameStart = glfwGetTime();
+
         // INPUT
-        processInput(window, updated_filepath, &mix_add, glm::value_ptr(trans_vec));
+        if (benchFrames == 0)
+            processInput(window, &mix_add, glm::value_ptr(trans_vec));
         ourShader.setFloat("mixing", 0.2f + mix_add);
 
         // transformations
@@ -223,9 +357,47 @@ int main() {
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
 
+        if (benchFrames > 0)
+        {
+            // phase 0: no capture, 1: synchronous readback, 2: PBO ring
+            int phase = benchFrame / benchFrames;
+            if (phase == 1)
+            {
+                int w, h, stride;
+                readPixelsSync(benchBuffer, &w, &h, &stride);
+            }
+            else if (phase == 2)
+            {
+                captureRing.request();
+                while (captureRing.retrieve(benchCapture))
+                    ;
+            }
+        }
+
         // process events, swap buffers
         glfwSwapBuffers(window);
         glfwPollEvents();
+        // the bench drains captureRing itself and takes no input; queueing
+        // its readbacks would time (and write) PNG encodes as well
+        if (benchFrames == 0)
+        {
+            captureController.poll();
+            frameRecorder.update(frameStart);
+        }
+
+        if (benchFrames > 0)
+        {
+            benchTimes[benchFrame / benchFrames].push_back(glfwGetTime() - frameStart);
+            if (++benchFrame == 3 * benchFrames)
+                glfwSetWindowShouldClose(window, true);
+        }
+    }
+
+    if (benchFrames > 0)
+    {
+        reportFrameTimes("no capture", benchTimes[0]);
+        reportFrameTimes("sync glReadPixels", benchTimes[1]);
+        reportFrameTimes("PBO ring", benchTimes[2]);
     }
 
     // De-allocate resources
@@ -233,6 +405,13 @@ int main() {
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
     ourShader.deleteShader();
+    frameRecorder.stop();
+    captureRing.release();
+    captureQueue.stop();
+    stbi_write_set_parallel(NULL, NULL, 0);
+    stbi_set_parallel(NULL, NULL, 0);
+    if (captureQueue.getStats().queued > 0)
+        captureQueue.printStats();
 
     // Terminate GLFW
     glfwTerminate();
@@ -247,11 +426,22 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 }
 
 // handle inputs
-void processInput(GLFWwindow *window, const char* filepath, float* mix_add, float* translation_vec3) {
+void processInput(GLFWwindow *window, float* mix_add, float* translation_vec3) {
+    // edge-triggered, so holding C takes a single screenshot
+    captureController.update(glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS, glfwGetTime());
+
+    static bool recordKeyDown = false;
+    bool recordKey = glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS;
+    if (recordKey && !recordKeyDown) {
+        if (frameRecorder.recording())
+            frameRecorder.stop();
+        else
+            frameRecorder.start(recordingPath(), recordMaxFrames);
+    }
+    recordKeyDown = recordKey;
+
     if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
-    else if(glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS)
-        saveImage(filepath, window);
     else if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
             *mix_add += 0.001f;
             if (*mix_add > 0.8)
@@ -276,26 +466,65 @@ void processInput(GLFWwindow *window, const char* filepath, float* mix_add, floa
     }
 }
 
+// lets stb_image and stb_image_write run their band jobs on a ThreadPool
+void parallelForPool(void* pool, stbi_write_job_func* job, void* context, int count) {
+    ((ThreadPool*)pool)->parallelFor(count, [&](int i) { job(context, i); });
+}
+
 // Credit to Lencerf, 
 // from: https://lencerf.github.io/post/2019-09-21-save-the-opengl-rendering-to-image-file/
-void saveImage(const char* filepath, GLFWwindow* w) {
-    
-    int width, height;
+// the original blocking path, kept for the --capture-bench comparison
+void readPixelsSync(std::vector<char>& buffer, int* width, int* height, int* stride) {
     GLint pView[4];
     glGetIntegerv(GL_VIEWPORT, pView);
-    width = pView[2];
-    height = pView[3];
+    *width = pView[2];
+    *height = pView[3];
 
     GLsizei nrChannels = 3;
-    GLsizei stride = nrChannels * width;
-    stride += (stride % 4) ? (4 - stride % 4) : 0;
-    GLsizei bufferSize = stride * height;
+    *stride = nrChannels * *width;
+    *stride += (*stride % 4) ? (4 - *stride % 4) : 0;
+    GLsizei bufferSize = *stride * *height;
 
-    std::vector<char> buffer(bufferSize);
+    buffer.resize(bufferSize);
     glPixelStorei(GL_PACK_ALIGNMENT, 4);
     glReadBuffer(GL_FRONT);
-    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, buffer.data());
+    glReadPixels(0, 0, *width, *height, GL_RGB, GL_UNSIGNED_BYTE, buffer.data());
+}
 
-    stbi_flip_vertically_on_write(true);
-    stbi_write_png(filepath, width, height, nrChannels, buffer.data(), stride);
-}
\ No newline at end of file
+// print mean / p99 / max frame time in milliseconds
+void reportFrameTimes(const char* label, std::vector<double>& times) {
+    if (times.empty())
+        return;
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for (double t : times)
+        sum += t;
+    size_t p99 = std::min(times.size() - 1, (size_t)(times.size() * 0.99));
+    std::cout << label << ": mean " << 1000.0 * sum / times.size()
+              << " ms, p99 " << 1000.0 * times[p99]
+              << " ms, max " << 1000.0 * times.back() << " ms" << std::endl;
+}
+
+// <filepath><year>_<month>_<day>_<hhmmss>.frames for a new recording
+std::string recordingPath() {
+    time_t now = time(0);
+    char name[64];
+    strftime(name, sizeof(name), "%Y_%m_%d_%H%M%S.frames", localtime(&now));
+    return std::string(filepath) + name;
+}
+
+// true if the current context lists the extension
+bool hasExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+        if (std::string((const char*)glGetStringi(GL_EXTENSIONS, i)) == name)
+            return true;
+    return false;
+}
+
+// the GL internal format of a block-compressed image
+GLenum compressedFormat(BlockFormat format) {
+    return format == BLOCK_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+         : format == BLOCK_BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_BPTC_UNORM;
+}
@@ -0,0 +1,97 @@
+// Converts a raw frame recording (see include/frameRecorder.h) into one image
+// per frame, encoding frames in parallel with stb_image_write:
+//     frameconv <recording> <output-dir> [png|jpg] [workers]
+// Writes <output-dir>/frame_00000.png ... plus timestamps.csv with the
+// glfwGetTime() value of every frame.
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <frameSequence.h>
+#include <mappedFile.h>
+#include <threadPool.h>
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::printf("usage: frameconv <recording> <output-dir> [png|jpg] [workers]\n");
+        return 1;
+    }
+    std::string outDir = std::string(argv[2]) + "/";
+    bool jpg = argc > 3 && std::string(argv[3]) == "jpg";
+    int nrWorkers = argc > 4 ? atoi(argv[4]) : 0;
+
+    MappedFile file;
+    if (!file.open(argv[1]))
+        return 1;
+    FrameSequenceHeader header;
+    if (file.size() < sizeof(header))
+    {
+        std::printf("ERROR::FRAMECONV::NOT_A_RECORDING: %s\n", argv[1]);
+        return 1;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (!frameSequenceValid(header, file.size()))
+    {
+        std::printf("ERROR::FRAMECONV::NOT_A_RECORDING: %s\n", argv[1]);
+        return 1;
+    }
+    const double* timestamps = frameSequenceTimestamps(file.data());
+
+    // frames are stored bottom-up, as read from OpenGL
+    stbi_flip_vertically_on_write(true);
+
+    ThreadPool pool(nrWorkers);
+    std::atomic<int> failed{0};
+    auto start = std::chrono::steady_clock::now();
+    pool.parallelFor((int)header.frameCount, [&](int i) {
+        char name[32];
+        snprintf(name, sizeof(name), jpg ? "frame_%05d.jpg" : "frame_%05d.png", i);
+        std::string path = outDir + name;
+        unsigned char* pixels = frameSequenceFrame(file.data(), header, i);
+        int width = header.width, height = header.height, n = header.nrChannels;
+
+        int ok;
+        if (jpg)
+        {
+            // the JPEG writer wants packed rows
+            std::vector<unsigned char> packed((size_t)width * n * height);
+            for (int y = 0; y < height; y++)
+                memcpy(&packed[(size_t)y * width * n], pixels + (size_t)y * header.rowStride, (size_t)width * n);
+            ok = stbi_write_jpg(path.c_str(), width, height, n, packed.data(), 90);
+        }
+        else
+        {
+            ok = stbi_write_png(path.c_str(), width, height, n, pixels, header.rowStride);
+        }
+        if (!ok)
+        {
+            std::printf("ERROR::FRAMECONV::WRITE_FAILED: %s\n", path.c_str());
+            failed++;
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FILE* csv = fopen((outDir + "timestamps.csv").c_str(), "w");
+    if (csv)
+    {
+        fprintf(csv, "frame,time\n");
+        for (uint32_t i = 0; i < header.frameCount; i++)
+            fprintf(csv, "%u,%.6f\n", i, timestamps[i]);
+        fclose(csv);
+    }
+
+    double mb = (double)header.frameBytes * header.frameCount / (1024.0 * 1024.0);
+    std::printf("%u frames (%ux%u) in %.2f s with %d workers, %.0f MB/s\n", header.frameCount, header.width,
+                header.height, seconds, pool.size(), seconds > 0 ? mb / seconds : 0.0);
+    return failed > 0 ? 1 : 0;
+}
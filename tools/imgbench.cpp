@@ -0,0 +1,1141 @@
+// Microbenchmarks for the stb_image / stb_image_write paths used by the
+// capture and texture code. Run from the repository root so the sample
+// textures are found:
+//     imgbench            run everything
+//     imgbench filter     run only the named benchmarks
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <blockCompress.h>
+#include <mipmap.h>
+#include <textureAtlas.h>
+#include <textureLoader.h>
+#include <threadPool.h>
+
+struct Frame
+{
+    std::string name;
+    int width, height, nrChannels;
+    std::vector<unsigned char> pixels;
+};
+
+// best of reps runs, in milliseconds
+static double timeMs(int reps, const std::function<void()>& f)
+{
+    double best = 1e30;
+    for (int r = 0; r < reps; r++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+static double mbPerSec(size_t bytes, double ms)
+{
+    return bytes / (1024.0 * 1024.0) / (ms / 1000.0);
+}
+
+// a frame of the given size tiled from a sample texture, so it compresses
+// and filters like real content rather than noise
+static Frame tiledFrame(const char* path, int width, int height, int nrChannels)
+{
+    Frame frame = { std::string(path) + " " + std::to_string(width) + "x" + std::to_string(height),
+                    width, height, nrChannels, {} };
+    frame.pixels.resize((size_t)width * height * nrChannels);
+
+    int w, h, n;
+    unsigned char* data = stbi_load(path, &w, &h, &n, nrChannels);
+    if (!data)
+    {
+        std::printf("ERROR::IMGBENCH::LOAD_FAILED: %s\n", path);
+        return frame;
+    }
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            memcpy(&frame.pixels[((size_t)y * width + x) * nrChannels],
+                   &data[((size_t)(y % h) * w + (x % w)) * nrChannels], nrChannels);
+    stbi_image_free(data);
+    return frame;
+}
+
+static std::vector<Frame> captureFrames()
+{
+    std::vector<Frame> frames;
+    frames.push_back(tiledFrame("src/resources/container.jpg", 512, 512, 3));
+    frames.push_back(tiledFrame("src/resources/container.jpg", 3840, 2160, 3));
+    frames.push_back(tiledFrame("src/resources/awesomeface.png", 3840, 2160, 4));
+    return frames;
+}
+
+// PNG row filtering: five filters plus cost estimate per row
+// ----------------------------------------------------------------------------
+static void benchFilter()
+{
+    std::printf("\n[filter] PNG adaptive filter selection\n");
+    for (Frame& frame : captureFrames())
+    {
+        int len = frame.width * frame.nrChannels;
+        std::vector<unsigned char> filt((size_t)(len + 1) * frame.height);
+        std::vector<signed char> scratch(stbiw__PNG_SCRATCH(frame.width, frame.nrChannels));
+        auto run = [&]() {
+            stbiw__png_filter_rows(frame.pixels.data(), len, frame.width, frame.height, frame.nrChannels,
+                                   -1, 0, frame.height, filt.data(), scratch.data());
+        };
+
+        stbi_write_use_simd = 0;
+        double scalar = timeMs(5, run);
+        stbi_write_use_simd = 1;
+        double simd = timeMs(5, run);
+        std::printf("  %-40s scalar %8.2f ms  simd %8.2f ms  (%.1fx, %.0f MB/s)\n", frame.name.c_str(),
+                    scalar, simd, scalar / simd, mbPerSec(frame.pixels.size(), simd));
+    }
+}
+
+// PNG-filtered frame bytes, the input the deflate benchmarks compress
+static std::vector<unsigned char> filteredFrame(const Frame& frame)
+{
+    int len = frame.width * frame.nrChannels;
+    std::vector<unsigned char> filt((size_t)(len + 1) * frame.height);
+    std::vector<signed char> scratch(stbiw__PNG_SCRATCH(frame.width, frame.nrChannels));
+    stbiw__png_filter_rows(frame.pixels.data(), len, frame.width, frame.height, frame.nrChannels,
+                           -1, 0, frame.height, filt.data(), scratch.data());
+    return filt;
+}
+
+// LZ77 match finder + fixed-huffman deflate at each quality level
+// ----------------------------------------------------------------------------
+static void benchDeflate()
+{
+    std::printf("\n[deflate] stbi_zlib_compress on filtered frames\n");
+    for (Frame& frame : captureFrames())
+    {
+        std::vector<unsigned char> filt = filteredFrame(frame);
+        for (int quality : { 1, 5, 8, 9, 10 })
+        {
+            int outLen = 0;
+            double ms = timeMs(3, [&]() {
+                unsigned char* z = stbi_zlib_compress(filt.data(), (int)filt.size(), &outLen, quality);
+                STBIW_FREE(z);
+            });
+            std::printf("  %-40s q%-2d %8.2f ms  %6.0f MB/s  ratio %.3f\n", frame.name.c_str(), quality,
+                        ms, mbPerSec(filt.size(), ms), (double)outLen / filt.size());
+        }
+    }
+}
+
+// zlib decode in stb_image on the writer's streams: round-trip check, then
+// with the exact output size (as the PNG loader passes it) against the
+// default 16 KB initial buffer
+// ----------------------------------------------------------------------------
+static void benchInflate()
+{
+    std::printf("\n[inflate] stbi_zlib_decode_malloc on filtered frames\n");
+    for (Frame& frame : captureFrames())
+    {
+        std::vector<unsigned char> filt = filteredFrame(frame);
+        for (int quality : { 0, 1, 8 })
+        {
+            int zlen = 0;
+            unsigned char* z = stbi_zlib_compress(filt.data(), (int)filt.size(), &zlen, quality);
+            int outLen = 0;
+            char* out = stbi_zlib_decode_malloc((const char*)z, zlen, &outLen);
+            bool exact = out && outLen == (int)filt.size() && memcmp(out, filt.data(), filt.size()) == 0;
+            STBI_FREE(out);
+            double sized = timeMs(5, [&]() {
+                STBI_FREE(stbi_zlib_decode_malloc_guesssize((const char*)z, zlen, (int)filt.size(), &outLen));
+            });
+            double grown = timeMs(5, [&]() { STBI_FREE(stbi_zlib_decode_malloc((const char*)z, zlen, &outLen)); });
+            std::printf("  %-40s q%-2d %8.2f ms  %6.0f MB/s  (%.0f MB/s growing)%s\n", frame.name.c_str(), quality,
+                        sized, mbPerSec(filt.size(), sized), mbPerSec(filt.size(), grown), exact ? "" : "  MISMATCH");
+            STBIW_FREE(z);
+        }
+    }
+
+    // runs of short repeating patterns, so most matches are 2..7 bytes back
+    // and take the widened-copy path rather than the 8-byte or memset ones
+    uint32_t seed = 12345;
+    auto next = [&seed]() { return (seed = seed * 1664525u + 1013904223u) >> 8; };
+    for (int period = 2; period <= 7; period++)
+    {
+        std::vector<unsigned char> data(4 << 20);
+        for (size_t i = 0; i < data.size();)
+        {
+            unsigned char pattern[8];
+            for (int k = 0; k < period; k++)
+                pattern[k] = (unsigned char)next();
+            size_t run = std::min(data.size() - i, (size_t)(32 + next() % 480));
+            for (size_t k = 0; k < run; k++)
+                data[i + k] = pattern[k % period];
+            i += run;
+        }
+        int zlen = 0;
+        unsigned char* z = stbi_zlib_compress(data.data(), (int)data.size(), &zlen, 8);
+        int outLen = 0;
+        char* out = stbi_zlib_decode_malloc_guesssize((const char*)z, zlen, (int)data.size(), &outLen);
+        bool exact = out && outLen == (int)data.size() && memcmp(out, data.data(), data.size()) == 0;
+        STBI_FREE(out);
+        double ms = timeMs(5, [&]() {
+            STBI_FREE(stbi_zlib_decode_malloc_guesssize((const char*)z, zlen, (int)data.size(), &outLen));
+        });
+        std::printf("  period %d runs%-27s q8  %8.2f ms  %6.0f MB/s%s\n", period, "", ms, mbPerSec(data.size(), ms),
+                    exact ? "" : "  MISMATCH");
+        STBIW_FREE(z);
+    }
+}
+
+static void countBytes(void* context, void* data, int size)
+{
+    (void)data;
+    *(size_t*)context += size;
+}
+
+// whole-file PNG encode at each capture speed tier: compression level
+// (8 = default, 1 = fast, -1 = RLE only, 0 = stored) against the row filter
+// ----------------------------------------------------------------------------
+static void benchPngTiers()
+{
+    std::printf("\n[png] stbi_write_png_to_func_ex per speed tier\n");
+    const struct
+    {
+        const char* name;
+        int level;
+    } tiers[] = { { "default", 8 }, { "fast", 1 }, { "rle", -1 }, { "store", 0 } };
+    const struct
+    {
+        const char* name;
+        int filter;
+    } filters[] = { { "adaptive", -1 }, { "none", 0 }, { "sub", 1 }, { "up", 2 } };
+
+    for (Frame& frame : captureFrames())
+    {
+        for (const auto& tier : tiers)
+        {
+            for (const auto& filter : filters)
+            {
+                size_t bytes = 0;
+                double ms = timeMs(3, [&]() {
+                    bytes = 0;
+                    stbi_write_png_to_func_ex(countBytes, &bytes, frame.width, frame.height, frame.nrChannels,
+                                              frame.pixels.data(), 0, tier.level, filter.filter);
+                });
+                std::printf("  %-40s %-7s %-8s %8.2f ms  %6.0f MB/s  ratio %.3f\n", frame.name.c_str(), tier.name,
+                            filter.name, ms, mbPerSec(frame.pixels.size(), ms), (double)bytes / frame.pixels.size());
+            }
+        }
+    }
+}
+
+// JPEG encode (colour conversion, DCT, quantization, Huffman), scalar against
+// SIMD; q90 uses 4:2:0 chroma subsampling, q95 does not
+// ----------------------------------------------------------------------------
+static void benchJpeg()
+{
+    std::printf("\n[jpeg] stbi_write_jpg_to_func\n");
+    for (Frame& frame : captureFrames())
+    {
+        for (int quality : { 90, 95 })
+        {
+            size_t bytes[2] = { 0, 0 };
+            double ms[2];
+            for (int simd = 0; simd < 2; simd++)
+            {
+                stbi_write_use_simd = simd;
+                ms[simd] = timeMs(3, [&]() {
+                    bytes[simd] = 0;
+                    stbi_write_jpg_to_func(countBytes, &bytes[simd], frame.width, frame.height, frame.nrChannels,
+                                           frame.pixels.data(), quality);
+                });
+            }
+            std::printf("  %-40s q%-3d scalar %8.2f ms  simd %8.2f ms  (%.1fx, %.0f MB/s)%s\n", frame.name.c_str(),
+                        quality, ms[0], ms[1], ms[0] / ms[1], mbPerSec(frame.pixels.size(), ms[1]),
+                        bytes[0] == bytes[1] ? "" : "  SIZE MISMATCH");
+        }
+    }
+}
+
+// CRC-32 of the PNG chunks and Adler-32 of the zlib stream; the fast paths
+// are checked bit-exact against the byte-at-a-time versions before timing
+// ----------------------------------------------------------------------------
+static void benchChecksum()
+{
+    std::printf("\n[checksum] CRC-32 / Adler-32\n");
+    std::vector<unsigned char> data(64 << 20);
+    unsigned int seed = 12345;
+    for (unsigned char& c : data)
+    {
+        seed = seed * 1103515245 + 12345;
+        c = (unsigned char)(seed >> 16);
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < 2000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int offset = (seed >> 8) % 64;
+        int len = i < 1000 ? (int)(seed >> 16) % 512 : (int)((seed >> 4) % (1 << 20));
+        unsigned char* p = data.data() + offset;
+
+        unsigned int crc = ~stbiw__crc32_bytes(~0u, p, len);
+        unsigned int adler = stbiw__adler32_scalar(1, p, len);
+        stbi_write_use_simd = 0;
+        mismatches += stbiw__crc32(p, len) != crc;
+        stbi_write_use_simd = 1;
+        mismatches += stbiw__crc32(p, len) != crc;
+        mismatches += stbiw__adler32(1, p, len) != adler;
+    }
+    std::printf("  bit-exact check: %s\n", mismatches ? "MISMATCH" : "ok");
+
+    unsigned char* p = data.data();
+    int len = (int)data.size();
+    volatile unsigned int sink = 0;
+    double crcBytes = timeMs(3, [&]() { sink = stbiw__crc32_bytes(~0u, p, len); });
+    stbi_write_use_simd = 0;
+    double crcSlice = timeMs(3, [&]() { sink = stbiw__crc32(p, len); });
+    double adlerScalar = timeMs(3, [&]() { sink = stbiw__adler32(1, p, len); });
+    stbi_write_use_simd = 1;
+    double crcSimd = timeMs(3, [&]() { sink = stbiw__crc32(p, len); });
+    double adlerSimd = timeMs(3, [&]() { sink = stbiw__adler32(1, p, len); });
+    (void)sink;
+
+    std::printf("  crc32   bytewise %8.0f MB/s  slice-by-8 %8.0f MB/s  dispatched %8.0f MB/s\n",
+                mbPerSec(len, crcBytes), mbPerSec(len, crcSlice), mbPerSec(len, crcSimd));
+    std::printf("  adler32 scalar   %8.0f MB/s  simd       %8.0f MB/s\n", mbPerSec(len, adlerScalar),
+                mbPerSec(len, adlerSimd));
+}
+
+static void parallelForPool(void* pool, stbi_job_func* job, void* context, int count)
+{
+    ((ThreadPool*)pool)->parallelFor(count, [&](int i) { job(context, i); });
+}
+
+static void appendBytes(void* context, void* data, int size)
+{
+    std::vector<unsigned char>* out = (std::vector<unsigned char>*)context;
+    out->insert(out->end(), (unsigned char*)data, (unsigned char*)data + size);
+}
+
+// JPEG decode from memory, single-threaded against stbi_set_parallel() on a
+// ThreadPool. container.jpg has restart markers, so its scan is split as
+// well; the re-encoded frames have none and only get banded color conversion
+// ----------------------------------------------------------------------------
+static void benchJpegDecode()
+{
+    std::printf("\n[jpegdec] stbi_load_from_memory, serial vs parallel\n");
+    struct Input
+    {
+        std::string name;
+        std::vector<unsigned char> bytes;
+    };
+    std::vector<Input> inputs;
+    {
+        Input input = { "src/resources/container.jpg", {} };
+        FILE* file = fopen(input.name.c_str(), "rb");
+        if (file)
+        {
+            unsigned char buffer[4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+                input.bytes.insert(input.bytes.end(), buffer, buffer + n);
+            fclose(file);
+        }
+        inputs.push_back(input);
+    }
+    for (Frame& frame : captureFrames())
+    {
+        Input input = { frame.name + " q90", {} };
+        stbi_write_jpg_to_func(appendBytes, &input.bytes, frame.width, frame.height, frame.nrChannels,
+                               frame.pixels.data(), 90);
+        inputs.push_back(input);
+    }
+
+    ThreadPool pool;
+    for (Input& input : inputs)
+    {
+        int width = 0, height = 0, n;
+        double ms[2];
+        for (int parallel = 0; parallel < 2; parallel++)
+        {
+            if (parallel)
+                stbi_set_parallel(parallelForPool, &pool, pool.size() + 1);
+            ms[parallel] = timeMs(5, [&]() {
+                stbi_image_free(stbi_load_from_memory(input.bytes.data(), (int)input.bytes.size(), &width, &height, &n, 0));
+            });
+        }
+        stbi_set_parallel(NULL, NULL, 0);
+        std::printf("  %-44s %5dx%-5d serial %8.2f ms  parallel %8.2f ms  (%.1fx, %d threads)\n",
+                    input.name.c_str(), width, height, ms[0], ms[1], ms[0] / ms[1], pool.size() + 1);
+    }
+}
+
+// stbi_load_from_memory and free against a header probe plus
+// stbi_load_into_from_memory into one reused buffer, as TextureLoader does
+// ----------------------------------------------------------------------------
+static void benchLoadInto()
+{
+    std::printf("\n[loadinto] fresh allocation per load vs decoding into a reused buffer\n");
+    std::vector<unsigned char> buffer;
+    for (Frame& frame : captureFrames())
+    {
+        for (int png = 0; png < 2; png++)
+        {
+            std::vector<unsigned char> file;
+            if (png)
+                stbi_write_png_to_func(appendBytes, &file, frame.width, frame.height, frame.nrChannels,
+                                       frame.pixels.data(), frame.width * frame.nrChannels);
+            else
+                stbi_write_jpg_to_func(appendBytes, &file, frame.width, frame.height, frame.nrChannels,
+                                       frame.pixels.data(), 90);
+
+            int width, height, n;
+            unsigned char* fresh = NULL;
+            double freshMs = timeMs(5, [&]() {
+                stbi_image_free(fresh);
+                fresh = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &n, 0);
+            });
+            bool ok = false;
+            size_t size = 0;
+            double intoMs = timeMs(5, [&]() {
+                if (!stbi_info_from_memory(file.data(), (int)file.size(), &width, &height, &n))
+                    return;
+                size = stbi_decoded_size(width, height, n, NULL);
+                if (buffer.size() < size)
+                    buffer.resize(size);
+                ok = stbi_load_into_from_memory(file.data(), (int)file.size(), buffer.data(), buffer.size(), &width,
+                                                &height, &n, NULL);
+            });
+            ok &= fresh && memcmp(buffer.data(), fresh, size) == 0;
+            stbi_image_free(fresh);
+            std::printf("  %-40s %s  fresh %8.2f ms  into %8.2f ms  (%.2fx)%s\n", frame.name.c_str(),
+                        png ? "png" : "jpg", freshMs, intoMs, freshMs / intoMs, ok ? "" : "  MISMATCH");
+        }
+    }
+}
+
+// the scratch memory of a decode from the heap against a reused arena, both
+// into the same output buffer; the stats show what the arena takes off the heap
+// ----------------------------------------------------------------------------
+static void benchArena()
+{
+    std::printf("\n[arena] decode scratch memory from the heap vs a reused stbi_arena\n");
+    stbi_arena arena;
+    stbi_arena_init(&arena, NULL, 0);
+    std::vector<unsigned char> buffer, reference;
+    for (Frame& frame : captureFrames())
+    {
+        for (int png = 0; png < 2; png++)
+        {
+            std::vector<unsigned char> file;
+            if (png)
+                stbi_write_png_to_func(appendBytes, &file, frame.width, frame.height, frame.nrChannels,
+                                       frame.pixels.data(), frame.width * frame.nrChannels);
+            else
+                stbi_write_jpg_to_func(appendBytes, &file, frame.width, frame.height, frame.nrChannels,
+                                       frame.pixels.data(), 90);
+            int width, height, n;
+            if (!stbi_info_from_memory(file.data(), (int)file.size(), &width, &height, &n))
+                continue;
+            buffer.resize(stbi_decoded_size(width, height, n, NULL));
+
+            stbi_decode_stats heapStats, arenaStats;
+            stbi_decode_options options;
+            stbi_decode_options_init(&options);
+            options.stats = &heapStats;
+            bool ok = true;
+            double heapMs = timeMs(5, [&]() {
+                ok &= stbi_load_into_from_memory(file.data(), (int)file.size(), buffer.data(), buffer.size(), &width,
+                                                 &height, &n, &options) != 0;
+            });
+            reference = buffer;
+            options.stats = &arenaStats;
+            options.arena = &arena;
+            double arenaMs = timeMs(5, [&]() {
+                ok &= stbi_load_into_from_memory(file.data(), (int)file.size(), buffer.data(), buffer.size(), &width,
+                                                 &height, &n, &options) != 0;
+            });
+            ok &= buffer == reference;
+            std::printf("  %-40s %s  heap %8.2f ms  arena %8.2f ms  (%.2fx)  %3zu allocs, %6.1f MB total, "
+                        "%6.1f MB peak, %6.1f MB in arena%s\n",
+                        frame.name.c_str(), png ? "png" : "jpg", heapMs, arenaMs, heapMs / arenaMs,
+                        heapStats.allocations, heapStats.total_bytes / (1024.0 * 1024.0),
+                        heapStats.peak_bytes / (1024.0 * 1024.0), arenaStats.arena_bytes / (1024.0 * 1024.0),
+                        ok ? "" : "  MISMATCH");
+        }
+    }
+    stbi_arena_free(&arena);
+}
+
+// drop a file from the page cache, so the next read comes from the disk
+static void evictFromPageCache(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// a directory of large textures read the three ways: stbi_load's FILE* path
+// (128-byte refills), TextureLoader reading each file into a buffer, and
+// TextureLoader mapping it. First just getting at the bytes, then full loads
+// on the same pool; cold runs evict the files from the page cache first
+// ----------------------------------------------------------------------------
+static void benchTextureLoad()
+{
+    std::printf("\n[texload] stbi_load vs TextureLoader read and mmap, cold and warm page cache\n");
+    char dir[] = "/tmp/imgbench_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        std::printf("ERROR::IMGBENCH::MKDTEMP_FAILED\n");
+        return;
+    }
+    std::vector<std::string> paths;
+    Frame jpg = tiledFrame("src/resources/container.jpg", 2048, 2048, 3);
+    Frame png = tiledFrame("src/resources/awesomeface.png", 1024, 1024, 4);
+    size_t bytes = 0;
+    for (int i = 0; i < 12; i++)
+    {
+        std::string path = std::string(dir) + "/texture" + std::to_string(i) + (i % 2 ? ".png" : ".jpg");
+        if (i % 2)
+            stbi_write_png(path.c_str(), png.width, png.height, png.nrChannels, png.pixels.data(),
+                           png.width * png.nrChannels);
+        else
+            stbi_write_jpg(path.c_str(), jpg.width, jpg.height, jpg.nrChannels, jpg.pixels.data(), 90);
+        MappedFile file;
+        if (file.open(path))
+            bytes += file.size();
+        paths.push_back(path);
+    }
+
+    ThreadPool pool;
+    TextureLoader loader(pool);
+    std::atomic<int> failed{0};
+    std::atomic<unsigned> sink{0};
+    const char* names[] = { "stbi_load", "read", "mmap" };
+    auto coldAndWarm = [&](const std::function<void()>& run, double& cold, double& warm) {
+        cold = 1e30;
+        for (int r = 0; r < 3; r++)
+        {
+            for (const std::string& path : paths)
+                evictFromPageCache(path);
+            cold = std::min(cold, timeMs(1, run));
+        }
+        warm = timeMs(3, run);
+    };
+    std::printf("  %d files, %.1f MB\n", (int)paths.size(), bytes / (1024.0 * 1024.0));
+    for (int method = 0; method < 3; method++)
+    {
+        auto fetch = [&]() {
+            pool.parallelFor((int)paths.size(), [&](int i) {
+                unsigned sum = 0;
+                if (method == 0)
+                {
+                    FILE* f = fopen(paths[i].c_str(), "rb");
+                    unsigned char buffer[128];
+                    size_t n;
+                    while (f && (n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+                        sum += buffer[n - 1];
+                    if (f)
+                        fclose(f);
+                }
+                else if (method == 1)
+                {
+                    std::vector<unsigned char> data;
+                    if (TextureLoader::readFile(paths[i], data))
+                        sum += data.back();
+                }
+                else
+                {
+                    MappedFile file;
+                    if (file.open(paths[i], true))
+                        for (size_t k = 0; k < file.size(); k += 4096)
+                            sum += file.data()[k];
+                }
+                sink += sum;
+            });
+        };
+        auto load = [&]() {
+            if (method == 0)
+            {
+                pool.parallelFor((int)paths.size(), [&](int i) {
+                    int width, height, n;
+                    unsigned char* data = stbi_load(paths[i].c_str(), &width, &height, &n, 0);
+                    if (!data)
+                        failed++;
+                    stbi_image_free(data);
+                });
+                return;
+            }
+            loader.setMapFiles(method == 2);
+            for (const std::string& path : paths)
+                loader.load(path);
+            TextureLoader::Image image;
+            while (loader.next(image, true))
+            {
+                if (!image.pixels)
+                    failed++;
+                loader.recycle(image);
+            }
+        };
+        double fetchCold, fetchWarm, loadCold, loadWarm;
+        coldAndWarm(fetch, fetchCold, fetchWarm);
+        coldAndWarm(load, loadCold, loadWarm);
+        std::printf("  %-10s bytes cold %7.2f ms  warm %7.2f ms   load cold %8.2f ms  warm %8.2f ms\n",
+                    names[method], fetchCold, fetchWarm, loadCold, loadWarm);
+    }
+    if (failed)
+        std::printf("  %d loads FAILED\n", failed.load());
+
+    for (const std::string& path : paths)
+        unlink(path.c_str());
+    rmdir(dir);
+}
+
+// PNG unfiltering in stb_image: every filter on 3- and 4-channel images,
+// round-tripped through the writer's filters against the original pixels,
+// then whole-file decode times
+// ----------------------------------------------------------------------------
+static void benchPngDecode()
+{
+    std::printf("\n[pngdec] PNG unfilter kernels and stbi_load_from_memory\n");
+    std::vector<Frame> frames;
+    for (int size : { 512, 1024, 2048 })
+        for (int nrChannels : { 3, 4 })
+            frames.push_back(tiledFrame("src/resources/awesomeface.png", size, size, nrChannels));
+
+    const char* filterNames[] = { "none", "sub", "up", "avg", "paeth" };
+    for (Frame& frame : frames)
+    {
+        int len = frame.width * frame.nrChannels;
+        std::vector<unsigned char> filt((size_t)(len + 1) * frame.height);
+        std::vector<signed char> scratch(stbiw__PNG_SCRATCH(frame.width, frame.nrChannels));
+        std::vector<unsigned char> rows((size_t)len * frame.height);
+        std::vector<unsigned char> zero(len, 0);
+
+        std::printf("  %s, %d channels\n", frame.name.c_str(), frame.nrChannels);
+        for (int filter = 1; filter < 5; filter++)
+        {
+            stbiw__png_filter_rows(frame.pixels.data(), len, frame.width, frame.height, frame.nrChannels, filter, 0,
+                                   frame.height, filt.data(), scratch.data());
+            double ms[2] = { 0, 0 };
+            bool exact = true;
+            for (int simd = 0; simd < 2; simd++)
+            {
+#ifndef STBI_SSE2
+                if (simd)
+                    break;
+#endif
+                auto run = [&]() {
+                    for (int y = 0; y < frame.height; y++)
+                    {
+                        unsigned char* raw = &filt[(size_t)(len + 1) * y];
+                        unsigned char* prior = y ? &rows[(size_t)len * (y - 1)] : zero.data();
+                        int rowFilter = y ? raw[0] : first_row_filter[raw[0]];
+#ifdef STBI_SSE2
+                        if (simd)
+                            stbi__png_unfilter_row_simd(&rows[(size_t)len * y], raw + 1, prior, len, rowFilter,
+                                                        frame.nrChannels);
+                        else
+#endif
+                            stbi__png_unfilter_row(&rows[(size_t)len * y], raw + 1, prior, len, rowFilter,
+                                                   frame.nrChannels);
+                    }
+                };
+                ms[simd] = timeMs(5, run);
+                exact &= rows == frame.pixels;
+            }
+            std::printf("    %-6s scalar %8.0f MB/s  simd %8.0f MB/s  (%.1fx)%s\n", filterNames[filter],
+                        mbPerSec(rows.size(), ms[0]), ms[1] > 0 ? mbPerSec(rows.size(), ms[1]) : 0.0,
+                        ms[1] > 0 ? ms[0] / ms[1] : 0.0, exact ? "" : "  MISMATCH");
+        }
+
+        for (int filter : { -1, 4 })
+        {
+            std::vector<unsigned char> png;
+            stbi_write_force_png_filter = filter;
+            stbi_write_png_to_func(appendBytes, &png, frame.width, frame.height, frame.nrChannels,
+                                   frame.pixels.data(), len);
+            stbi_write_force_png_filter = -1;
+            int width, height, n;
+            double ms = timeMs(5, [&]() {
+                stbi_image_free(stbi_load_from_memory(png.data(), (int)png.size(), &width, &height, &n, 0));
+            });
+            std::printf("    decode (%s filters) %8.2f ms  (%.0f MB/s)\n", filter < 0 ? "adaptive" : "paeth", ms,
+                        mbPerSec(frame.pixels.size(), ms));
+        }
+    }
+}
+
+// the JPEG decoder's SIMD kernels against the scalar ones they must match
+// bit for bit (stbi__idct_block is the reference IDCT), then their speed
+// ----------------------------------------------------------------------------
+static void benchJpegKernels()
+{
+    std::printf("\n[jpegsimd] JPEG decode kernels\n");
+#ifdef STBI_AVX2
+    bool avx2 = stbi__avx2_available() != 0;
+#else
+    bool avx2 = false;
+#endif
+    unsigned int seed = 4711;
+    auto next = [&seed](int range) {
+        seed = seed * 1103515245 + 12345;
+        return (int)((seed >> 8) % (unsigned)range);
+    };
+
+    // coefficient blocks shaped like real ones: a DC term, energy falling
+    // off towards the high frequencies, many zeros
+    const int nrBlocks = 4096;
+    std::vector<short> coeffs((size_t)nrBlocks * 64 + 8);
+    short* blocks = (short*)(((uintptr_t)coeffs.data() + 15) & ~(uintptr_t)15);
+    for (int b = 0; b < nrBlocks; b++)
+        for (int i = 0; i < 64; i++)
+        {
+            int range = i == 0 ? 2048 : 1024 >> ((i / 8 + i % 8) / 2);
+            blocks[b * 64 + i] = next(4) == 0 || i == 0 ? (short)(next(range) - range / 2) : 0;
+        }
+
+    int mismatches = 0;
+    std::vector<stbi_uc> ref(nrBlocks * 64), out(nrBlocks * 64);
+    for (int b = 0; b < nrBlocks; b++)
+        stbi__idct_block(&ref[b * 64], 8, blocks + b * 64);
+#ifdef STBI_SSE2
+    for (int b = 0; b < nrBlocks; b++)
+        stbi__idct_simd(&out[b * 64], 8, blocks + b * 64);
+    mismatches += out != ref;
+#endif
+#ifdef STBI_AVX2
+    if (avx2)
+    {
+        std::fill(out.begin(), out.end(), 0);
+        for (int b = 0; b < nrBlocks; b += 2)
+            stbi__idct2_avx2(&out[b * 64], 8, blocks + b * 64, &out[(b + 1) * 64], 8, blocks + (b + 1) * 64);
+        mismatches += out != ref;
+    }
+#endif
+
+    // one row of a wide image, at every width up to 64 to cover the tails
+    const int width = 4096;
+    std::vector<stbi_uc> y(width), cb(width), cr(width), nearRow(width), farRow(width);
+    for (int i = 0; i < width; i++)
+    {
+        y[i] = (stbi_uc)next(256);
+        cb[i] = (stbi_uc)next(256);
+        cr[i] = (stbi_uc)next(256);
+        nearRow[i] = (stbi_uc)next(256);
+        farRow[i] = (stbi_uc)next(256);
+    }
+    std::vector<stbi_uc> refRgb(width * 4 + 1), rgb(width * 4 + 1);
+    for (int w = 1; w <= 64; w++)
+    {
+        stbi__resample_row_hv_2(refRgb.data(), nearRow.data(), farRow.data(), w, 2);
+#ifdef STBI_SSE2
+        stbi__resample_row_hv_2_simd(rgb.data(), nearRow.data(), farRow.data(), w, 2);
+        mismatches += memcmp(rgb.data(), refRgb.data(), w * 2) != 0;
+#endif
+#ifdef STBI_AVX2
+        if (avx2)
+        {
+            stbi__resample_row_hv_2_avx2(rgb.data(), nearRow.data(), farRow.data(), w, 2);
+            mismatches += memcmp(rgb.data(), refRgb.data(), w * 2) != 0;
+        }
+#endif
+#if defined(STBI_SSE2) && defined(STBI_AVX2)
+        // step 3 matches the scalar loop, step 4 the sse2 kernel
+        if (avx2)
+        {
+            stbi__YCbCr_to_RGB_row(refRgb.data(), y.data(), cb.data(), cr.data(), w, 3);
+            stbi__YCbCr_to_RGB_avx2(rgb.data(), y.data(), cb.data(), cr.data(), w, 3);
+            mismatches += memcmp(rgb.data(), refRgb.data(), w * 3) != 0;
+            stbi__YCbCr_to_RGB_simd(refRgb.data(), y.data(), cb.data(), cr.data(), w, 4);
+            stbi__YCbCr_to_RGB_avx2(rgb.data(), y.data(), cb.data(), cr.data(), w, 4);
+            mismatches += memcmp(rgb.data(), refRgb.data(), w * 4) != 0;
+        }
+#endif
+    }
+    std::printf("  bit-exact check: %s%s\n", mismatches ? "MISMATCH" : "ok", avx2 ? "" : " (no AVX2 on this CPU)");
+
+    // Mpixels/s: blocks are 64 pixels, rows width pixels
+    auto mpix = [](double pixels, double ms) { return pixels / (ms * 1000.0); };
+    const int reps = 200;
+    double idct[3] = { 0, 0, 0 }, hv2[3] = { 0, 0, 0 }, ycc3[3] = { 0, 0, 0 }, ycc4[3] = { 0, 0, 0 };
+    idct[0] = timeMs(5, [&]() {
+        for (int b = 0; b < nrBlocks; b++)
+            stbi__idct_block(&out[b * 64], 8, blocks + b * 64);
+    });
+    hv2[0] = timeMs(5, [&]() {
+        for (int r = 0; r < reps; r++)
+            stbi__resample_row_hv_2(rgb.data(), nearRow.data(), farRow.data(), width / 2, 2);
+    });
+    ycc3[0] = timeMs(5, [&]() {
+        for (int r = 0; r < reps; r++)
+            stbi__YCbCr_to_RGB_row(rgb.data(), y.data(), cb.data(), cr.data(), width, 3);
+    });
+    ycc4[0] = timeMs(5, [&]() {
+        for (int r = 0; r < reps; r++)
+            stbi__YCbCr_to_RGB_row(rgb.data(), y.data(), cb.data(), cr.data(), width, 4);
+    });
+#ifdef STBI_SSE2
+    idct[1] = timeMs(5, [&]() {
+        for (int b = 0; b < nrBlocks; b++)
+            stbi__idct_simd(&out[b * 64], 8, blocks + b * 64);
+    });
+    hv2[1] = timeMs(5, [&]() {
+        for (int r = 0; r < reps; r++)
+            stbi__resample_row_hv_2_simd(rgb.data(), nearRow.data(), farRow.data(), width / 2, 2);
+    });
+    ycc3[1] = timeMs(5, [&]() {
+        for (int r = 0; r < reps; r++)
+            stbi__YCbCr_to_RGB_simd(rgb.data(), y.data(), cb.data(), cr.data(), width, 3);
+    });
+    ycc4[1] = timeMs(5, [&]() {
+        for (int r = 0; r < reps; r++)
+            stbi__YCbCr_to_RGB_simd(rgb.data(), y.data(), cb.data(), cr.data(), width, 4);
+    });
+#endif
+#ifdef STBI_AVX2
+    if (avx2)
+    {
+        idct[2] = timeMs(5, [&]() {
+            for (int b = 0; b < nrBlocks; b += 2)
+                stbi__idct2_avx2(&out[b * 64], 8, blocks + b * 64, &out[(b + 1) * 64], 8, blocks + (b + 1) * 64);
+        });
+        hv2[2] = timeMs(5, [&]() {
+            for (int r = 0; r < reps; r++)
+                stbi__resample_row_hv_2_avx2(rgb.data(), nearRow.data(), farRow.data(), width / 2, 2);
+        });
+        ycc3[2] = timeMs(5, [&]() {
+            for (int r = 0; r < reps; r++)
+                stbi__YCbCr_to_RGB_avx2(rgb.data(), y.data(), cb.data(), cr.data(), width, 3);
+        });
+        ycc4[2] = timeMs(5, [&]() {
+            for (int r = 0; r < reps; r++)
+                stbi__YCbCr_to_RGB_avx2(rgb.data(), y.data(), cb.data(), cr.data(), width, 4);
+        });
+    }
+#endif
+    struct Row
+    {
+        const char* name;
+        double* ms;
+        double pixels;
+    } rows[] = { { "idct", idct, nrBlocks * 64.0 },
+                 { "upsample hv_2", hv2, (double)reps * width },
+                 { "YCbCr->RGB", ycc3, (double)reps * width },
+                 { "YCbCr->RGBA", ycc4, (double)reps * width } };
+    for (const Row& row : rows)
+    {
+        std::printf("  %-16s scalar %8.0f Mpix/s", row.name, mpix(row.pixels, row.ms[0]));
+        if (row.ms[1] > 0)
+            std::printf("  sse2 %8.0f Mpix/s", mpix(row.pixels, row.ms[1]));
+        if (row.ms[2] > 0)
+            std::printf("  avx2 %8.0f Mpix/s", mpix(row.pixels, row.ms[2]));
+        std::printf("\n");
+    }
+}
+
+// what gamma-correct mips look like written the obvious way: a 2x2 box of
+// even-sized 8-bit levels with a pow per value each way, alpha left linear
+static void naiveSrgbDownsample(const unsigned char* src, int width, int height, int nrChannels, unsigned char* dst)
+{
+    int dstWidth = std::max(width / 2, 1), dstHeight = std::max(height / 2, 1);
+    for (int y = 0; y < dstHeight; y++)
+        for (int x = 0; x < dstWidth; x++)
+            for (int c = 0; c < nrChannels; c++)
+            {
+                bool alpha = (nrChannels == 2 || nrChannels == 4) && c == nrChannels - 1;
+                float sum = 0.0f;
+                for (int dy = 0; dy < 2; dy++)
+                    for (int dx = 0; dx < 2; dx++)
+                    {
+                        int sx = std::min(2 * x + dx, width - 1), sy = std::min(2 * y + dy, height - 1);
+                        float v = src[((size_t)sy * width + sx) * nrChannels + c] / 255.0f;
+                        sum += alpha ? v : mipSrgbToLinear(v);
+                    }
+                float v = alpha ? sum / 4 : mipLinearToSrgb(sum / 4);
+                dst[((size_t)y * dstWidth + x) * nrChannels + c] = (unsigned char)(v * 255.0f + 0.5f);
+            }
+}
+
+// mipGenerate's levels below level 0, one after another, with the SIMD
+// kernels or the scalar loops
+static std::vector<unsigned char> mipChain(const unsigned char* pixels, int width, int height, int nrChannels,
+                                           int bitsPerChannel, const MipSettings& settings, bool simd,
+                                           ThreadPool* pool = NULL)
+{
+    int levelCount = mipLevelCount(width, height);
+    size_t bytes0 = (size_t)width * height * nrChannels * (bitsPerChannel / 8);
+    std::vector<unsigned char> chain(mipChainSize(width, height, nrChannels, bitsPerChannel));
+    std::vector<void*> levels(levelCount);
+    memcpy(chain.data(), pixels, bytes0);
+    for (int i = 0, offset = 0; i < levelCount; i++)
+    {
+        levels[i] = chain.data() + offset;
+        offset += mipLevelSize(width, i) * mipLevelSize(height, i) * nrChannels * (bitsPerChannel / 8);
+    }
+    mipSimdEnabled() = simd;
+    mipGenerate(levels.data(), levelCount, width, height, nrChannels, bitsPerChannel, settings, pool);
+    mipSimdEnabled() = true;
+    chain.erase(chain.begin(), chain.begin() + bytes0);
+    return chain;
+}
+
+// the SIMD kernels against the scalar loops on random images: every channel
+// count and depth, odd sizes, both filters, linear and sRGB; returns the
+// number of chains that differ
+static int mipSimdMismatches(int& chains)
+{
+    const int sizes[][2] = { { 1, 1 }, { 2, 2 }, { 3, 5 }, { 17, 9 }, { 64, 64 }, { 127, 33 }, { 256, 255 } };
+    uint32_t seed = 12345;
+    int mismatches = 0;
+    chains = 0;
+    for (const auto& size : sizes)
+        for (int bits : { 8, 16, 32 })
+            for (int n = 1; n <= 4; n++)
+            {
+                std::vector<unsigned char> pixels((size_t)size[0] * size[1] * n * (bits / 8));
+                if (bits == 32)
+                    for (size_t i = 0; i < pixels.size() / 4; i++)
+                        ((float*)pixels.data())[i] = ((seed = seed * 1664525u + 1013904223u) >> 8) / 16777216.0f;
+                else
+                    for (unsigned char& byte : pixels)
+                        byte = (unsigned char)((seed = seed * 1664525u + 1013904223u) >> 24);
+                for (MipFilter filter : { MIP_BOX, MIP_KAISER })
+                    for (bool srgb : { false, true })
+                    {
+                        MipSettings settings;
+                        settings.filter = filter;
+                        settings.srgb = srgb;
+                        chains++;
+                        mismatches += mipChain(pixels.data(), size[0], size[1], n, bits, settings, true) !=
+                                      mipChain(pixels.data(), size[0], size[1], n, bits, settings, false);
+                    }
+            }
+    return mismatches;
+}
+
+// a full mip chain: naive scalar 2x2 boxes (mipDownsample in encoded values,
+// naiveSrgbDownsample in linear light) against mipGenerate's box and Kaiser
+// filters, on the calling thread and over a pool; each variant's output is
+// checked against the scalar loops'
+// ----------------------------------------------------------------------------
+static void benchMips()
+{
+    std::printf("\n[mips] full mip chain: naive scalar box vs mipGenerate\n");
+    int chains = 0;
+    int mismatches = mipSimdMismatches(chains);
+    std::printf("  SIMD vs scalar on %d random chains: %s\n", chains,
+                mismatches ? (std::to_string(mismatches) + " MISMATCH").c_str() : "identical");
+    ThreadPool pool;
+    for (Frame& frame : captureFrames())
+    {
+        int levelCount = mipLevelCount(frame.width, frame.height);
+        std::vector<std::vector<unsigned char>> chain(levelCount);
+        std::vector<void*> levels(levelCount);
+        for (int i = 0; i < levelCount; i++)
+        {
+            chain[i].resize((size_t)mipLevelSize(frame.width, i) * mipLevelSize(frame.height, i) * frame.nrChannels);
+            levels[i] = chain[i].data();
+        }
+        chain[0] = frame.pixels;
+        levels[0] = chain[0].data();
+
+        for (int srgb = 0; srgb < 2; srgb++)
+        {
+            double naiveMs = timeMs(3, [&]() {
+                for (int i = 1; i < levelCount; i++)
+                    (srgb ? naiveSrgbDownsample : mipDownsample)(chain[i - 1].data(), mipLevelSize(frame.width, i - 1),
+                                                                 mipLevelSize(frame.height, i - 1), frame.nrChannels,
+                                                                 chain[i].data());
+            });
+            std::printf("  %-40s %-12s %8.2f ms %8.1f MB/s\n", srgb ? "" : frame.name.c_str(),
+                        srgb ? "naive srgb" : "naive", naiveMs, mbPerSec(frame.pixels.size(), naiveMs));
+        }
+        struct Variant
+        {
+            const char* name;
+            MipFilter filter;
+            bool srgb;
+        } variants[] = { { "box", MIP_BOX, false }, { "box srgb", MIP_BOX, true }, { "kaiser srgb", MIP_KAISER, true } };
+        for (const Variant& variant : variants)
+        {
+            MipSettings settings;
+            settings.filter = variant.filter;
+            settings.srgb = variant.srgb;
+            double serialMs = timeMs(3, [&]() {
+                mipGenerate(levels.data(), levelCount, frame.width, frame.height, frame.nrChannels, 8, settings);
+            });
+            double poolMs = timeMs(3, [&]() {
+                mipGenerate(levels.data(), levelCount, frame.width, frame.height, frame.nrChannels, 8, settings,
+                            &pool);
+            });
+            bool exact = mipChain(frame.pixels.data(), frame.width, frame.height, frame.nrChannels, 8, settings, true,
+                                  &pool) ==
+                         mipChain(frame.pixels.data(), frame.width, frame.height, frame.nrChannels, 8, settings, false);
+            std::printf("  %-40s %-12s %8.2f ms %8.1f MB/s   %d workers %8.2f ms %8.1f MB/s%s\n", "", variant.name,
+                        serialMs, mbPerSec(frame.pixels.size(), serialMs), pool.size() + 1, poolMs,
+                        mbPerSec(frame.pixels.size(), poolMs), exact ? "" : "  MISMATCH");
+        }
+    }
+}
+
+// peak signal-to-noise ratio of channels [first, first + count) of decoded
+// RGBA against the frame, in dB
+static double psnr(const Frame& frame, const std::vector<unsigned char>& rgba, int first, int count)
+{
+    double squared = 0.0;
+    for (size_t i = 0; i < (size_t)frame.width * frame.height; i++)
+        for (int c = first; c < first + count; c++)
+        {
+            double d = (double)frame.pixels[i * frame.nrChannels + c] - rgba[i * 4 + c];
+            squared += d * d;
+        }
+    double mse = squared / ((double)frame.width * frame.height * count);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+// BC1/BC3/BC7 encode throughput, serial and over the pool, and the quality
+// that comes back out of blockDecompress
+// ----------------------------------------------------------------------------
+static void benchBlocks()
+{
+    std::printf("\n[bc] block compression: throughput and PSNR (RGB, alpha)\n");
+    ThreadPool pool;
+    for (Frame& frame : captureFrames())
+    {
+        const char* names[] = { "BC1", "BC3", "BC7" };
+        for (int i = 0; i < 3; i++)
+        {
+            BlockFormat format = (BlockFormat)i;
+            std::vector<unsigned char> blocks(blockCompressedSize(format, frame.width, frame.height));
+            std::vector<unsigned char> rgba((size_t)frame.width * frame.height * 4);
+            double serialMs = timeMs(2, [&]() {
+                blockCompress(frame.pixels.data(), frame.width, frame.height, frame.nrChannels, format,
+                              blocks.data());
+            });
+            double poolMs = timeMs(2, [&]() {
+                blockCompress(frame.pixels.data(), frame.width, frame.height, frame.nrChannels, format,
+                              blocks.data(), &pool);
+            });
+            blockDecompress(blocks.data(), frame.width, frame.height, format, rgba.data());
+            char quality[64];
+            if (frame.nrChannels == 4 && format != BLOCK_BC1)
+                std::snprintf(quality, sizeof(quality), "%6.2f dB %6.2f dB", psnr(frame, rgba, 0, 3),
+                              psnr(frame, rgba, 3, 1));
+            else
+                std::snprintf(quality, sizeof(quality), "%6.2f dB", psnr(frame, rgba, 0, 3));
+            std::printf("  %-40s %-4s %8.2f ms %8.1f MB/s   %d workers %8.2f ms %8.1f MB/s   %s\n",
+                        i == 0 ? frame.name.c_str() : "", names[i], serialMs, mbPerSec(frame.pixels.size(), serialMs),
+                        pool.size() + 1, poolMs, mbPerSec(frame.pixels.size(), poolMs), quality);
+        }
+    }
+}
+
+// atlas packing of synthetic sprite sets: layout time and occupancy for
+// both packers, with and without mip-safe cells, then the copy into pages
+// ----------------------------------------------------------------------------
+static void benchAtlas()
+{
+    std::printf("\n[atlas] sprite sets into 1024x1024 RGBA pages, 2 texel gutters\n");
+    ThreadPool pool;
+    struct SpriteSet
+    {
+        const char* name;
+        int count, smallest, largest;
+    } sets[] = { { "500 sprites 16-128", 500, 16, 128 },
+                 { "2000 icons 8-48", 2000, 8, 48 },
+                 { "200 tiles 32-256", 200, 32, 256 } };
+    uint32_t seed = 12345;
+    auto random = [&seed](int lo, int hi) {
+        seed = seed * 1664525u + 1013904223u;
+        return lo + (int)((seed >> 8) % (uint32_t)(hi - lo + 1));
+    };
+    for (const SpriteSet& set : sets)
+    {
+        std::vector<std::vector<unsigned char>> pixels(set.count);
+        std::vector<AtlasImage> images(set.count);
+        for (int i = 0; i < set.count; i++)
+        {
+            int width = random(set.smallest, set.largest), height = random(set.smallest, set.largest);
+            pixels[i].assign((size_t)width * height * 4, (unsigned char)i);
+            images[i] = { width, height, pixels[i].data() };
+        }
+        const char* packings[] = { "skyline", "maxrects" };
+        for (int packing = 0; packing < 2; packing++)
+            for (int mipLevels = 0; mipLevels <= 4; mipLevels += 4)
+            {
+                AtlasSettings settings;
+                settings.packing = (AtlasPacking)packing;
+                settings.mipLevels = mipLevels;
+                settings.pageSize = 1024;
+                std::vector<AtlasRegion> regions;
+                int pages = 0;
+                double layoutMs = timeMs(3, [&]() { pages = atlasLayout(images.data(), set.count, settings, regions); });
+                TextureAtlas atlas;
+                double serialMs = timeMs(3, [&]() { atlasBuild(images.data(), set.count, 4, settings, atlas); });
+                double poolMs = timeMs(3, [&]() { atlasBuild(images.data(), set.count, 4, settings, atlas, &pool); });
+                char name[32];
+                std::snprintf(name, sizeof(name), "%s mips %d", packings[packing], mipLevels);
+                std::printf("  %-20s %-16s layout %7.2f ms  %d pages %5.1f%% used   build %7.2f ms  %d workers %7.2f ms\n",
+                            packing == 0 && mipLevels == 0 ? set.name : "", name, layoutMs, pages,
+                            100.0 * atlasOccupancy(atlas), serialMs, pool.size() + 1, poolMs);
+            }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    struct Bench
+    {
+        const char* name;
+        void (*run)();
+    };
+    const Bench benches[] = {
+        { "filter", benchFilter },
+        { "deflate", benchDeflate },
+        { "inflate", benchInflate },
+        { "checksum", benchChecksum },
+        { "png", benchPngTiers },
+        { "jpeg", benchJpeg },
+        { "jpegdec", benchJpegDecode },
+        { "jpegsimd", benchJpegKernels },
+        { "pngdec", benchPngDecode },
+        { "loadinto", benchLoadInto },
+        { "arena", benchArena },
+        { "texload", benchTextureLoad },
+        { "mips", benchMips },
+        { "bc", benchBlocks },
+        { "atlas", benchAtlas },
+    };
+
+    for (const Bench& bench : benches)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+            selected |= std::strcmp(argv[i], bench.name) == 0;
+        if (selected)
+            bench.run();
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+// Bakes images into GPU-ready containers (see include/bakedTexture.h): decoded
+// with stb_image and mipmapped on the CPU, so the app maps them at startup
+// instead of decoding and calling glGenerateMipmap:
+//     texbake [--flip] [--channels n] [--srgb] [--kaiser] [--force] <image>...
+// Writes <image>.baked next to each image. --flip and --channels must match
+// how the app loads the texture, or it ignores the bake; --srgb filters the
+// mips in linear light and --kaiser sharpens them (see include/mipmap.h).
+// Images whose bake is already current are skipped unless --force is given.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <bakedTexture.h>
+#include <mappedFile.h>
+#include <mipmap.h>
+#include <threadPool.h>
+
+// true if the bake at bakedPath was made from the source as it is now, with
+// the same settings
+static bool bakeCurrent(const std::string& bakedPath, uint64_t sourceSize, int64_t sourceMtime, bool flip,
+                        int desiredChannels, uint32_t mipFlags)
+{
+    if (!MappedFile::isMappable(bakedPath))
+        return false;
+    MappedFile file;
+    BakedTextureHeader header;
+    if (!file.open(bakedPath) || file.size() < sizeof(header))
+        return false;
+    memcpy(&header, file.data(), sizeof(header));
+    return bakedTextureValid(header, file.size()) &&
+           bakedTextureCurrent(header, sourceSize, sourceMtime, flip, desiredChannels) &&
+           (header.flags & (BAKED_TEXTURE_SRGB_MIPS | BAKED_TEXTURE_KAISER_MIPS)) == mipFlags;
+}
+
+// decode straight into level 0 of a new mapping, then build the other
+// levels in place, over pool
+static bool bake(const std::string& path, bool flip, int desiredChannels, const MipSettings& mips,
+                 uint64_t sourceSize, int64_t sourceMtime, ThreadPool& pool, uint64_t& outBytes)
+{
+    int width, height, fileChannels;
+    if (!stbi_info(path.c_str(), &width, &height, &fileChannels))
+    {
+        std::printf("ERROR::TEXBAKE::LOAD_FAILED: %s (%s)\n", path.c_str(), stbi_failure_reason());
+        return false;
+    }
+    int nrChannels = desiredChannels ? desiredChannels : fileChannels;
+    BakedTextureHeader header;
+    uint64_t size = bakedTextureLayout(header, width, height, nrChannels, mipLevelCount(width, height));
+    header.desiredChannels = desiredChannels;
+    header.flags = (flip ? BAKED_TEXTURE_FLIPPED : 0) | bakedTextureMipFlags(mips);
+    header.sourceSize = sourceSize;
+    header.sourceMtime = sourceMtime;
+
+    std::string bakedPath = bakedTexturePath(path);
+    std::string tempPath = bakedPath + ".tmp";
+    MappedFile file;
+    if (!file.create(tempPath, size))
+        return false;
+    stbi_decode_options options;
+    stbi_decode_options_init(&options);
+    options.flip_vertically = flip;
+    options.desired_channels = desiredChannels;
+    int x, y, n;
+    if (!stbi_load_into(path.c_str(), bakedTextureLevel(file.data(), header, 0), header.levels[0].bytes, &x, &y, &n,
+                        &options))
+    {
+        std::printf("ERROR::TEXBAKE::LOAD_FAILED: %s (%s)\n", path.c_str(), stbi_failure_reason());
+        file.close();
+        remove(tempPath.c_str());
+        return false;
+    }
+    void* levels[BAKED_TEXTURE_MAX_LEVELS];
+    for (uint32_t i = 0; i < header.levelCount; i++)
+        levels[i] = bakedTextureLevel(file.data(), header, i);
+    mipGenerate(levels, header.levelCount, width, height, nrChannels, 8, mips, &pool);
+    // the header goes in last, so a bake cut short never looks valid
+    memcpy(file.data(), &header, sizeof(header));
+    file.close();
+    if (rename(tempPath.c_str(), bakedPath.c_str()) != 0)
+    {
+        std::printf("ERROR::TEXBAKE::WRITE_FAILED: %s\n", bakedPath.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+    outBytes = size;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool flip = false, force = false;
+    int desiredChannels = 0;
+    MipSettings mips;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--flip")
+            flip = true;
+        else if (arg == "--force")
+            force = true;
+        else if (arg == "--srgb")
+            mips.srgb = true;
+        else if (arg == "--kaiser")
+            mips.filter = MIP_KAISER;
+        else if (arg == "--channels" && i + 1 < argc)
+            desiredChannels = atoi(argv[++i]);
+        else
+            paths.push_back(arg);
+    }
+    if (paths.empty() || desiredChannels < 0 || desiredChannels > 4)
+    {
+        std::printf("usage: texbake [--flip] [--channels n] [--srgb] [--kaiser] [--force] <image>...\n");
+        return 1;
+    }
+
+    ThreadPool pool;
+    std::atomic<int> baked{0}, skipped{0}, failed{0};
+    std::atomic<uint64_t> bytes{0};
+    auto start = std::chrono::steady_clock::now();
+    pool.parallelFor((int)paths.size(), [&](int i) {
+        const std::string& path = paths[i];
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        if (!MappedFile::fileStamp(path, sourceSize, sourceMtime))
+        {
+            std::printf("ERROR::TEXBAKE::NOT_A_FILE: %s\n", path.c_str());
+            failed++;
+            return;
+        }
+        if (!force &&
+            bakeCurrent(bakedTexturePath(path), sourceSize, sourceMtime, flip, desiredChannels, bakedTextureMipFlags(mips)))
+        {
+            skipped++;
+            return;
+        }
+        uint64_t size = 0;
+        if (bake(path, flip, desiredChannels, mips, sourceSize, sourceMtime, pool, size))
+        {
+            baked++;
+            bytes += size;
+        }
+        else
+        {
+            failed++;
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%d baked (%.1f MB), %d up to date, %d failed in %.2f s\n", baked.load(),
+                bytes.load() / (1024.0 * 1024.0), skipped.load(), failed.load(), seconds);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+// Builds or refreshes the texture index of an asset directory (see
+// include/textureIndex.h), probing image headers in parallel:
+//     texscan <asset-dir> [index] [workers]
+// The index defaults to <asset-dir>/.texindex; only images added or changed
+// since it was written are read again.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <textureIndex.h>
+#include <threadPool.h>
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::printf("usage: texscan <asset-dir> [index] [workers]\n");
+        return 1;
+    }
+    std::string directory = argv[1];
+    std::string indexPath = argc > 2 ? argv[2] : directory + "/.texindex";
+    int nrWorkers = argc > 3 ? atoi(argv[3]) : 0;
+
+    ThreadPool pool(nrWorkers);
+    TextureIndex index;
+    bool existed = index.load(indexPath);
+    TextureIndex::ScanResult scan = index.scan(directory, pool);
+    if (scan.changed() || !existed)
+    {
+        if (!index.save(indexPath))
+            return 1;
+    }
+
+    uint64_t totalBytes = 0;
+    for (const TextureIndex::Entry& entry : index.all())
+    {
+        if (entry.valid)
+        {
+            std::printf("  %-48s %5dx%-5d %dch %2d-bit %10llu bytes\n", entry.path.c_str(), entry.width,
+                        entry.height, entry.nrChannels, entry.bitsPerChannel, (unsigned long long)entry.fileSize);
+            totalBytes += stbi_decoded_size(entry.width, entry.height, entry.nrChannels, NULL) *
+                          (entry.bitsPerChannel / 8);
+        }
+        else
+        {
+            std::printf("  %-48s not readable by stb_image\n", entry.path.c_str());
+        }
+    }
+    std::printf("%d images (%d probed, %d removed) in %.2f ms with %d workers, %.1f MB decoded\n", scan.files,
+                scan.probed, scan.removed, scan.ms, pool.size(), totalBytes / (1024.0 * 1024.0));
+    return 0;
+}